@@ -0,0 +1,96 @@
+﻿#include "async_run.h"
+
+using namespace Simulator;
+
+template<typename Scalar>
+BasicAsyncRun<Scalar>::BasicAsyncRun(const BasicIsingModel<Scalar>& isingModel, const std::size_t steps, const RunOptions& options,
+	const std::optional<double> targetEnergy)
+	: isingModel(isingModel)
+	, steps(steps)
+	, options(options)
+	, targetEnergy(targetEnergy)
+	, step(0)
+	, energy(isingModel.GetEnergy())
+	, cancelled(false)
+	, finished(false)
+	, back(0)
+	, front(1)
+	, middle(2)
+{
+	this->options.observables.clear();
+	this->options.snapshotInterval = 0;
+	for (auto& best : buffers)
+		best = { energy.load(), 0, isingModel.GetSpins() };
+	worker = std::thread([this]() { run(); });
+}
+
+template<typename Scalar>
+BasicAsyncRun<Scalar>::~BasicAsyncRun()
+{
+	Cancel();
+	if (worker.joinable())
+		worker.join();
+}
+
+template<typename Scalar>
+typename BasicAsyncRun<Scalar>::Progress BasicAsyncRun<Scalar>::GetProgress()
+{
+	bool isFinished = IsFinished();  // 終了を先に読めば、以下の値は終了時のもの。
+	if (middle.load(std::memory_order_relaxed) & Fresh)
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~Fresh;
+	const auto& best = buffers[front];
+	return { step.load(std::memory_order_acquire), energy.load(std::memory_order_relaxed), best.energy, best.step, best.spins, isFinished };
+}
+
+template<typename Scalar>
+void BasicAsyncRun<Scalar>::Wait()
+{
+	if (worker.joinable())
+		worker.join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+// Runを1回だけ呼び、各ステップの直後にstepCallbackで進捗を書き出して、止めるかどうかを判定する。
+// 最良の配位は改善したときだけ書き出す。
+template<typename Scalar>
+void BasicAsyncRun<Scalar>::run()
+{
+	try {
+		double bestEnergy = energy.load(std::memory_order_relaxed);
+		auto isStopped = [this, &bestEnergy]() {
+			return cancelled.load(std::memory_order_relaxed) || (targetEnergy && bestEnergy <= *targetEnergy);
+		};
+		if (!isStopped()) {
+			options.stepCallback = [this, &bestEnergy, &isStopped](const std::size_t completedSteps) {
+				double currentEnergy = isingModel.GetEnergy();
+				if (currentEnergy < bestEnergy) {
+					bestEnergy = currentEnergy;
+					publish(bestEnergy, completedSteps);
+				}
+				energy.store(currentEnergy, std::memory_order_relaxed);
+				step.store(completedSteps, std::memory_order_release);
+				return !isStopped();
+			};
+			isingModel.Run(steps, options);
+		}
+	} catch (...) {
+		error = std::current_exception();
+	}
+	finished.store(true, std::memory_order_release);
+}
+
+template<typename Scalar>
+void BasicAsyncRun<Scalar>::publish(const double bestEnergy, const std::size_t bestStep)
+{
+	auto& best = buffers[back];
+	best.energy = bestEnergy;
+	best.step = bestStep;
+	best.spins = isingModel.GetSpins();
+	back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & ~Fresh;
+}
+
+template class Simulator::BasicAsyncRun<double>;
+template class Simulator::BasicAsyncRun<float>;
+template class Simulator::BasicAsyncRun<std::int16_t>;
+template class Simulator::BasicAsyncRun<std::int8_t>;
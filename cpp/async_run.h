@@ -0,0 +1,90 @@
+﻿#ifndef ASYNC_RUN_H
+#define ASYNC_RUN_H
+
+#include "simulator.h"
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace Simulator {
+	// IsingModelの複製を裏のスレッドで実行する。実行中は、最新のステップ数とエネルギー、それまでの最良の配位を
+	// ロックなしで読める。Cancelか、最良のエネルギーがtargetEnergy以下になった時点で止まる。
+	template<typename Scalar>
+	class BasicAsyncRun {
+	public:
+		struct Progress {
+			std::size_t step;         // 終えたステップ数。
+			double energy;            // 最新の H(s).
+			double bestEnergy;
+			std::size_t bestStep;     // bestSpinsを得たステップ数。
+			Eigen::VectorXi bestSpins;
+			bool finished;
+		};
+
+		// optionsの物理量の記録とstepCallbackは無視する。スケジュールは options.firstStep + n で評価する。
+		BasicAsyncRun(const BasicIsingModel<Scalar>& isingModel, const std::size_t steps, const RunOptions& options = {},
+			const std::optional<double> targetEnergy = std::nullopt);
+		BasicAsyncRun(const BasicAsyncRun&) = delete;
+		BasicAsyncRun& operator=(const BasicAsyncRun&) = delete;
+		~BasicAsyncRun();
+
+		// 最新の状態。読み出しは1つのスレッドから行う。
+		Progress GetProgress();
+		// 実行の終了を待つ。実行中に例外が起きていれば、ここで投げ直す。
+		void Wait();
+
+		// 次のステップの前に止める。
+		void Cancel()
+		{
+			cancelled.store(true, std::memory_order_relaxed);
+		}
+
+		bool IsFinished() const
+		{
+			return finished.load(std::memory_order_acquire);
+		}
+
+		bool IsCancelled() const
+		{
+			return cancelled.load(std::memory_order_relaxed);
+		}
+
+		// 実行しているモデル。Waitの後で使う。
+		const BasicIsingModel<Scalar>& GetModel() const
+		{
+			return isingModel;
+		}
+	private:
+		struct Best {
+			double energy;
+			std::size_t step;
+			Eigen::VectorXi spins;
+		};
+
+		// 三重バッファ: 実行スレッドはbuffers[back]を書いてからmiddleと交換し、読み出し側はbuffers[front]とmiddleを交換する。
+		// middleの Fresh ビットは、最後に読んでから新しい値が書かれたことを表す。
+		static constexpr unsigned int Fresh = 4;
+
+		BasicIsingModel<Scalar> isingModel;
+		std::size_t steps;
+		RunOptions options;
+		std::optional<double> targetEnergy;
+		std::atomic<std::size_t> step;
+		std::atomic<double> energy;
+		std::atomic<bool> cancelled;
+		std::atomic<bool> finished;
+		std::array<Best, 3> buffers;
+		unsigned int back;
+		unsigned int front;
+		std::atomic<unsigned int> middle;
+		std::exception_ptr error;
+		std::thread worker;
+
+		void run();
+		void publish(const double bestEnergy, const std::size_t bestStep);
+	};
+
+	using AsyncRun = BasicAsyncRun<double>;
+}
+
+#endif // !ASYNC_RUN_H
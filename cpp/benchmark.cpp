@@ -0,0 +1,409 @@
+﻿#include "simulator.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+// 全てのアルゴリズムを、グラフの種類、頂点数、密度とスレッド数の組毎に測り、結果をJSONで出力する。
+// Usage: benchmark [--graphs erdos_renyi,spin_glass,lattice] [--sizes 256,1024] [--densities 0.01,0.1,0.5] [--threads 1,4]
+//                  [--steps 200] [--min-seconds 0.2] [--target-ratio 0.99] [--seed 32] [--output benchmark.json]
+//
+// nsPerUpdate: Update() 1回あたりの時間。HillClimbingは一様ランダムな配位からの1回の降下（GiveSpinsを含む）。
+// spinUpdatesPerSecond: MetropolisとGlauberはUpdate 1回で1スピン、それ以外はNスピンとして数える。
+// timeToTarget: 指数関数的に冷却する焼きなまし（MetropolisとGlauberは1ステップ = 1スイープ、HillClimbingは無作為な再出発）で、
+//     H(s) が初めて目標以下になるまでの秒数。目標は同じ問題の全結果の最良値 E* から E* + (1 - targetRatio) |E*|. 届かなければnull.
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const std::vector<std::pair<Simulator::Algorithms, std::string>> AlgorithmNames = {
+        { Simulator::Algorithms::Metropolis, "Metropolis" },
+        { Simulator::Algorithms::Glauber, "Glauber" },
+        { Simulator::Algorithms::SCA, "SCA" },
+        { Simulator::Algorithms::fcSCA, "fcSCA" },
+        { Simulator::Algorithms::MA, "MA" },
+        { Simulator::Algorithms::MMA, "MMA" },
+        { Simulator::Algorithms::HillClimbing, "HillClimbing" }
+    };
+
+    struct Settings {
+        std::vector<std::string> graphs{ "erdos_renyi", "spin_glass", "lattice" };
+        std::vector<std::size_t> sizes{ 256, 1024 };
+        std::vector<double> densities{ 0.01, 0.1, 0.5 };
+        std::vector<std::size_t> threads{ 1, std::max(1u, std::thread::hardware_concurrency()) };
+        std::size_t steps = 200;
+        double minSeconds = 0.2;
+        double targetRatio = 0.99;
+        unsigned int seed = 32;
+        std::string output;
+    };
+
+    // 結合定数はすべて -1 か +1.
+    struct Instance {
+        std::string graph;
+        std::size_t size;
+        double density;  // latticeでは実際の辺の割合。
+        std::vector<std::size_t> rows;
+        std::vector<std::size_t> columns;
+        std::vector<double> weights;
+        std::size_t maxDegree;
+    };
+
+    struct Result {
+        std::size_t instance;
+        std::size_t threads;
+        std::string algorithm;
+        std::size_t nonZeros;
+        bool sparse;
+        std::size_t couplingBytes;
+        double nsPerUpdate;
+        double spinUpdatesPerSecond;
+        double annealingSeconds;
+        double bestEnergy;
+        std::vector<std::pair<double, double>> improvements;  // 最良値が更新された時刻と値。
+        double targetEnergy;
+        std::optional<double> timeToTarget;
+    };
+
+    double secondsSince(const Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    template<typename T>
+    std::vector<T> parseList(const std::string& text)
+    {
+        std::vector<T> result;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            std::stringstream itemStream(item);
+            T value;
+            if (!(itemStream >> value))
+                throw std::invalid_argument("Invalid list: " + text);
+            result.push_back(value);
+        }
+        return result;
+    }
+
+    Settings parseArguments(const int argc, char* argv[])
+    {
+        Settings settings;
+        for (auto k = 1; k < argc; k++) {
+            std::string option = argv[k];
+            if (k + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + option);
+            std::string value = argv[++k];
+            if (option == "--graphs")
+                settings.graphs = parseList<std::string>(value);
+            else if (option == "--sizes")
+                settings.sizes = parseList<std::size_t>(value);
+            else if (option == "--densities")
+                settings.densities = parseList<double>(value);
+            else if (option == "--threads")
+                settings.threads = parseList<std::size_t>(value);
+            else if (option == "--steps")
+                settings.steps = std::stoul(value);
+            else if (option == "--min-seconds")
+                settings.minSeconds = std::stod(value);
+            else if (option == "--target-ratio")
+                settings.targetRatio = std::stod(value);
+            else if (option == "--seed")
+                settings.seed = static_cast<unsigned int>(std::stoul(value));
+            else if (option == "--output")
+                settings.output = value;
+            else
+                throw std::invalid_argument("Unknown option " + option);
+        }
+        std::sort(settings.threads.begin(), settings.threads.end());
+        settings.threads.erase(std::unique(settings.threads.begin(), settings.threads.end()), settings.threads.end());
+        return settings;
+    }
+
+    // erdos_renyi: 確率densityで強磁性の辺 (J = -1). spin_glass: 確率densityで J = ±1 の辺. lattice: 開放端の正方格子の強磁性の辺.
+    Instance generateInstance(const std::string& graph, const std::size_t size, const double density, const unsigned int seed)
+    {
+        Rand rand(seed, 0);
+        Instance instance{ graph, size, density, {}, {}, {}, 0 };
+        auto addEdge = [&instance](const std::size_t i, const std::size_t j, const double weight) {
+            instance.rows.push_back(i);
+            instance.columns.push_back(j);
+            instance.weights.push_back(weight);
+        };
+        if (graph == "lattice") {
+            auto columns = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(size))));
+            for (std::size_t i = 0; i < size; i++) {
+                if ((i + 1) % columns > 0 && i + 1 < size)
+                    addEdge(i, i + 1, -1.e0);
+                if (i + columns < size)
+                    addEdge(i, i + columns, -1.e0);
+            }
+            instance.density = (size > 1) ? 2.e0 * instance.weights.size() / (static_cast<double>(size) * (size - 1)) : 0.e0;
+        } else if (graph == "erdos_renyi" || graph == "spin_glass") {
+            for (std::size_t i = 0; i < size; i++)
+                for (std::size_t j = i + 1; j < size; j++)
+                    if (rand.Bernoulli(density))
+                        addEdge(i, j, (graph == "erdos_renyi" || rand.Bernoulli(0.5e0)) ? -1.e0 : +1.e0);
+        } else {
+            throw std::invalid_argument("Unknown graph " + graph);
+        }
+        std::vector<std::size_t> degrees(size, 0);
+        for (std::size_t k = 0; k < instance.weights.size(); k++) {
+            degrees[instance.rows[k]]++;
+            degrees[instance.columns[k]]++;
+        }
+        instance.maxDegree = degrees.empty() ? 0 : *std::max_element(degrees.begin(), degrees.end());
+        return instance;
+    }
+
+    // 係数はmain.cppと同じ。初期温度は局所磁場の大きさの上限。
+    double configure(Simulator::IsingModel& isingModel, const Simulator::Algorithms algorithm, const Instance& instance)
+    {
+        isingModel.ChangeAlgorithmTo(algorithm);
+        switch (algorithm) {
+        case Simulator::Algorithms::SCA:
+        case Simulator::Algorithms::MA:
+        case Simulator::Algorithms::MMA:
+            isingModel.SetPinningParameter(isingModel.CalcLargestEigenvalue() * 0.5e0);
+            break;
+        case Simulator::Algorithms::fcSCA:
+            isingModel.SetPinningParameter(isingModel.CalcLargestEigenvalue() * 0.125e0);
+            isingModel.SetFlipTrialRate(0.75e0);
+            break;
+        default:
+            break;
+        }
+        return std::max<double>(instance.maxDegree, 1.e0) + isingModel.GetPinningParameter();
+    }
+
+    std::size_t spinsPerUpdate(const Simulator::Algorithms algorithm, const std::size_t size)
+    {
+        return (algorithm == Simulator::Algorithms::Metropolis || algorithm == Simulator::Algorithms::Glauber) ? 1 : size;
+    }
+
+    std::size_t couplingBytes(const Simulator::CouplingMatrix& couplings)
+    {
+        auto size = couplings.Size();
+        if (!couplings.IsSparse())
+            return size * size * sizeof(double);
+        return (size + 1) * sizeof(std::int64_t) + couplings.NonZeros() * (sizeof(std::int32_t) + sizeof(double));
+    }
+
+    // 最低でもminSeconds秒、回数を倍々に増やしながら繰り返す。
+    double measureUpdate(Simulator::IsingModel& isingModel, const double minSeconds)
+    {
+        bool restarts = isingModel.GetCurrentAlgorithm() == Simulator::Algorithms::HillClimbing;
+        std::size_t count = 0;
+        auto start = Clock::now();
+        for (std::size_t batch = 1; count == 0 || secondsSince(start) < minSeconds; batch *= 2) {
+            for (std::size_t k = 0; k < batch; k++) {
+                if (restarts)
+                    isingModel.GiveSpins(Simulator::ConfigurationsType::Uniform);
+                isingModel.Update();
+            }
+            count += batch;
+        }
+        return secondsSince(start) / count;
+    }
+
+    Result runBenchmark(const std::size_t instanceIndex, const Instance& instance, const std::size_t numThreads,
+        const std::pair<Simulator::Algorithms, std::string>& algorithm, const Settings& settings)
+    {
+        auto isingModel = Simulator::IsingModel::FromCoo(Eigen::VectorXd::Zero(instance.size), instance.rows, instance.columns, instance.weights);
+        if (numThreads > 1)
+            isingModel.SetNumThreads(numThreads);
+        double initialTemperature = configure(isingModel, algorithm.first, instance);
+        const double finalTemperature = 0.05e0;
+        double rate = std::pow(finalTemperature / initialTemperature, 1.e0 / std::max<double>(settings.steps - 1.e0, 1.e0));
+        auto schedule = Simulator::Schedule::Exponential(initialTemperature, rate);
+
+        Result result{ instanceIndex, numThreads, algorithm.second, isingModel.GetCouplingMatrix()->NonZeros(), isingModel.HasSparseCouplings(),
+            couplingBytes(*isingModel.GetCouplingMatrix()), 0.e0, 0.e0, 0.e0, 0.e0, {}, 0.e0, std::nullopt };
+        isingModel.SetSeed(settings.seed, 1);
+        isingModel.GiveSpins(Simulator::ConfigurationsType::Uniform);
+        isingModel.SetTemperature(schedule(settings.steps / 2));
+        double secondsPerUpdate = measureUpdate(isingModel, settings.minSeconds);
+        result.nsPerUpdate = secondsPerUpdate * 1.e9;
+        result.spinUpdatesPerSecond = spinsPerUpdate(algorithm.first, instance.size) / secondsPerUpdate;
+
+        isingModel.SetSeed(settings.seed, 2);
+        isingModel.GiveSpins(Simulator::ConfigurationsType::Uniform);
+        std::size_t updatesPerStep = (algorithm.first == Simulator::Algorithms::Metropolis || algorithm.first == Simulator::Algorithms::Glauber) ? instance.size : 1;
+        result.bestEnergy = std::numeric_limits<double>::infinity();
+        auto start = Clock::now();
+        for (std::size_t n = 0; n < settings.steps; n++) {
+            isingModel.SetTemperature(schedule(n));
+            if (algorithm.first == Simulator::Algorithms::HillClimbing)
+                isingModel.GiveSpins(Simulator::ConfigurationsType::Uniform);
+            for (std::size_t k = 0; k < updatesPerStep; k++)
+                isingModel.Update();
+            if (isingModel.GetEnergy() < result.bestEnergy) {
+                result.bestEnergy = isingModel.GetEnergy();
+                result.improvements.emplace_back(secondsSince(start), result.bestEnergy);
+            }
+        }
+        result.annealingSeconds = secondsSince(start);
+        return result;
+    }
+
+    void setTargets(std::vector<Result>& results, const std::size_t first, const double targetRatio)
+    {
+        double reference = std::numeric_limits<double>::infinity();
+        for (auto k = first; k < results.size(); k++)
+            reference = std::min(reference, results[k].bestEnergy);
+        double target = reference + (1.e0 - targetRatio) * std::abs(reference);
+        for (auto k = first; k < results.size(); k++) {
+            results[k].targetEnergy = target;
+            for (const auto& improvement : results[k].improvements) {
+                if (improvement.second <= target) {
+                    results[k].timeToTarget = improvement.first;
+                    break;
+                }
+            }
+        }
+    }
+
+    // 全実行を通した最大常駐メモリ。取得できなければ0.
+    std::size_t peakResidentBytes()
+    {
+#ifdef __unix__
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            return static_cast<std::size_t>(usage.ru_maxrss) * 1024;  // Linuxではキロバイト単位。
+#endif
+        return 0;
+    }
+
+    std::string quote(const std::string& text)
+    {
+        return "\"" + text + "\"";
+    }
+
+    template<typename T>
+    std::string joinList(const std::vector<T>& values, const bool quoted = false)
+    {
+        std::stringstream stream;
+        stream.precision(17);
+        stream << "[";
+        for (std::size_t k = 0; k < values.size(); k++) {
+            std::stringstream item;
+            item.precision(17);
+            item << values[k];
+            stream << (k > 0 ? ", " : "") << (quoted ? quote(item.str()) : item.str());
+        }
+        stream << "]";
+        return stream.str();
+    }
+
+    // JSONには無限大やNaNを書けないので、代わりにnullを書く（ステップ数が0ならば最良のエネルギーは無限大のまま）。
+    // -Ofastではstd::isfiniteが常に真に畳まれるので、指数部を直接調べる。
+    void writeNumber(std::ostream& stream, const double value)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        if ((bits & 0x7ff0000000000000u) != 0x7ff0000000000000u)
+            stream << value;
+        else
+            stream << "null";
+    }
+
+    void writeJson(std::ostream& stream, const Settings& settings, const std::vector<Instance>& instances, const std::vector<Result>& results)
+    {
+        stream.precision(10);
+        stream << "{\n";
+        stream << "  \"settings\": {\n";
+        stream << "    \"graphs\": " << joinList(settings.graphs, true) << ",\n";
+        stream << "    \"sizes\": " << joinList(settings.sizes) << ",\n";
+        stream << "    \"densities\": " << joinList(settings.densities) << ",\n";
+        stream << "    \"threads\": " << joinList(settings.threads) << ",\n";
+        stream << "    \"steps\": " << settings.steps << ",\n";
+        stream << "    \"minSeconds\": " << settings.minSeconds << ",\n";
+        stream << "    \"targetRatio\": " << settings.targetRatio << ",\n";
+        stream << "    \"seed\": " << settings.seed << ",\n";
+        stream << "    \"hardwareConcurrency\": " << std::thread::hardware_concurrency() << "\n";
+        stream << "  },\n";
+        stream << "  \"peakResidentBytes\": " << peakResidentBytes() << ",\n";
+        stream << "  \"results\": [";
+        for (std::size_t k = 0; k < results.size(); k++) {
+            const auto& result = results[k];
+            const auto& instance = instances[result.instance];
+            stream << (k > 0 ? "," : "") << "\n    {";
+            stream << "\"graph\": " << quote(instance.graph) << ", \"size\": " << instance.size << ", \"density\": " << instance.density;
+            stream << ", \"nonZeros\": " << result.nonZeros << ", \"sparse\": " << (result.sparse ? "true" : "false");
+            stream << ", \"threads\": " << result.threads << ", \"algorithm\": " << quote(result.algorithm);
+            stream << ", \"nsPerUpdate\": " << result.nsPerUpdate << ", \"spinUpdatesPerSecond\": " << result.spinUpdatesPerSecond;
+            stream << ", \"couplingBytes\": " << result.couplingBytes;
+            stream << ", \"annealingSeconds\": " << result.annealingSeconds << ", \"bestEnergy\": ";
+            writeNumber(stream, result.bestEnergy);
+            stream << ", \"targetEnergy\": ";
+            writeNumber(stream, result.targetEnergy);
+            stream << ", \"timeToTarget\": ";
+            if (result.timeToTarget)
+                stream << *result.timeToTarget;
+            else
+                stream << "null";
+            stream << "}";
+        }
+        stream << "\n  ]\n}\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    try {
+        settings = parseArguments(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<Instance> instances;
+    std::vector<Result> results;
+    for (const auto& graph : settings.graphs) {
+        auto densities = (graph == "lattice") ? std::vector<double>{ 0.e0 } : settings.densities;
+        for (const auto size : settings.sizes) {
+            for (const auto density : densities) {
+                instances.push_back(generateInstance(graph, size, density, settings.seed));
+                auto first = results.size();
+                for (const auto numThreads : settings.threads) {
+                    for (const auto& algorithm : AlgorithmNames) {
+                        try {
+                            results.push_back(runBenchmark(instances.size() - 1, instances.back(), numThreads, algorithm, settings));
+                        } catch (const std::exception& e) {  // 最大固有値が収束しなかった場合など。この組み合わせだけ飛ばす。
+                            std::cerr << graph << " N=" << size << " threads=" << numThreads << " " << algorithm.second << ": " << e.what() << std::endl;
+                            continue;
+                        }
+                        std::cerr << graph << " N=" << size << " density=" << instances.back().density << " threads=" << numThreads
+                            << " " << algorithm.second << ": " << results.back().nsPerUpdate << " ns/update" << std::endl;
+                    }
+                }
+                setTargets(results, first, settings.targetRatio);
+            }
+        }
+    }
+
+    if (settings.output.empty()) {
+        writeJson(std::cout, settings, instances, results);
+    } else {
+        std::ofstream file(settings.output);
+        if (!file) {
+            std::cerr << "unable to open " << settings.output << std::endl;
+            return 1;
+        }
+        writeJson(file, settings, instances, results);
+        file.close();
+        if (!file) {
+            std::cerr << "failed to write " << settings.output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
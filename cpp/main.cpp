@@ -1,8 +1,8 @@
 ﻿#include "simulator.h"
+#include "trajectory_writer.h"
 //#include <chrono>
 #include <cmath>
 //#include <ctime>
-#include <iomanip>
 #include <iostream>
 #include <numeric>
 //#include <sstream>
@@ -107,16 +107,14 @@ int main()
     std::cout << ss.str() << std::endl;*/
 
     isingModel.Write();
-    for (auto n = 0; n <= maxTrials; n++) {
-        //isingModel.SetTemperature(initialTemperature / (std::sqrt(maxNodes) * std::log(n + 1) + 1.e0));  // Alogarithmic cooling schedule.
-        //isingModel.SetTemperature(initialTemperature / (n + 1.e0));  // A linear multiplicative cooling schedule.
-        //isingModel.SetTemperature(1.e0 + (initialTemperature - 1.e0) * (maxTrials - n) / maxTrials);  // A linearadditive cooling schedule (whose final temperature is 1.e0).
-        isingModel.SetTemperature(initialTemperature * std::pow(0.99e0, n));  // An exponential cooling schedule.
-        isingModel.Update();
-        std::cout << std::setw(7) << std::left << n
-            << std::setw(16) << std::scientific << std::setprecision(5) << calcEnergy(isingModel)
-            << std::setw(16) << std::scientific << std::setprecision(7) << isingModel.GetTemperature()
-            << std::endl;
-    }
+    Simulator::RunOptions options;
+    // 各ステップの値を裏のスレッドでCSVとして標準出力に書き出す。
+    options.trajectoryWriter = std::make_shared<Simulator::TrajectoryWriter>(std::cout);
+    //options.temperatureSchedule = Simulator::Schedule::Logarithmic(initialTemperature, std::sqrt(maxNodes));  // Alogarithmic cooling schedule.
+    //options.temperatureSchedule = Simulator::Schedule::LinearMultiplicative(initialTemperature);  // A linear multiplicative cooling schedule.
+    //options.temperatureSchedule = Simulator::Schedule::LinearAdditive(initialTemperature, 1.e0, maxTrials);  // A linearadditive cooling schedule (whose final temperature is 1.e0).
+    options.temperatureSchedule = Simulator::Schedule::Exponential(initialTemperature, 0.99e0);  // An exponential cooling schedule.
+    isingModel.Run(maxTrials + 1, options);
+    options.trajectoryWriter->Close();
     return 0;
 }
@@ -0,0 +1,464 @@
+﻿#include "model_file.h"
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Simulator;
+
+namespace {
+	constexpr char Magic[8] = { 'I', 'S', 'I', 'N', 'G', 'M', 'D', 'L' };
+	constexpr std::uint32_t Version = 1;
+	constexpr std::uint32_t ByteOrderMark = 0x01020304u;
+	constexpr std::uint64_t Alignment = 64;
+
+	enum class ScalarTypes : std::uint32_t {
+		Float64 = 1,
+		Float32,
+		Int16,
+		Int8
+	};
+
+	template<typename Scalar>
+	constexpr ScalarTypes scalarTypeOf()
+	{
+		if constexpr (std::is_same_v<Scalar, double>)
+			return ScalarTypes::Float64;
+		else if constexpr (std::is_same_v<Scalar, float>)
+			return ScalarTypes::Float32;
+		else if constexpr (std::is_same_v<Scalar, std::int16_t>)
+			return ScalarTypes::Int16;
+		else
+			return ScalarTypes::Int8;
+	}
+
+	// 各配列の位置はファイルの先頭からのバイト数。labelsOffsetが0ならば頂点の名前はない。
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byteOrderMark;
+		ScalarTypes scalarType;
+		std::uint32_t isSparse;
+		std::uint64_t numNodes;
+		std::uint64_t numNonZeros;  // 密行列ならば N * N.
+		std::uint64_t fieldOffset;
+		std::uint64_t rowOffsetsOffset;
+		std::uint64_t columnIndicesOffset;
+		std::uint64_t valuesOffset;
+		std::uint64_t labelsOffset;
+		std::uint64_t fileSize;
+	};
+
+	std::uint64_t scalarSizeOf(const ScalarTypes scalarType)
+	{
+		switch (scalarType) {
+		case ScalarTypes::Float64:
+			return sizeof(double);
+		case ScalarTypes::Float32:
+			return sizeof(float);
+		case ScalarTypes::Int16:
+			return sizeof(std::int16_t);
+		case ScalarTypes::Int8:
+			return sizeof(std::int8_t);
+		default:
+			return 0;
+		}
+	}
+
+	std::uint64_t alignUp(const std::uint64_t offset)
+	{
+		return (offset + Alignment - 1) / Alignment * Alignment;
+	}
+
+	// ファイル全体を読み取り専用で写像する。
+	class MappedFile {
+	public:
+		explicit MappedFile(const std::string& path)
+		{
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("LoadModel: cannot open " + path);
+			LARGE_INTEGER fileSize;
+			GetFileSizeEx(file, &fileSize);
+			size = static_cast<std::size_t>(fileSize.QuadPart);
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+				data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (!data) {
+				if (mapping)
+					CloseHandle(mapping);
+				CloseHandle(file);
+				throw std::runtime_error("LoadModel: cannot map " + path);
+			}
+#else
+			int descriptor = open(path.c_str(), O_RDONLY);
+			if (descriptor < 0)
+				throw std::runtime_error("LoadModel: cannot open " + path);
+			struct stat status;
+			if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+				close(descriptor);
+				throw std::runtime_error("LoadModel: cannot map " + path);
+			}
+			size = static_cast<std::size_t>(status.st_size);
+			void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			close(descriptor);  // 写像はファイル記述子を閉じても残る。
+			if (address == MAP_FAILED)
+				throw std::runtime_error("LoadModel: cannot map " + path);
+			data = static_cast<const char*>(address);
+#endif
+		}
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			if (data)
+				UnmapViewOfFile(data);
+			if (mapping)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+#else
+			if (data)
+				munmap(const_cast<char*>(data), size);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const char* Data() const
+		{
+			return data;
+		}
+
+		std::size_t Size() const
+		{
+			return size;
+		}
+	private:
+		const char* data = nullptr;
+		std::size_t size = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#endif
+	};
+
+	std::string encodeLabels(const std::vector<Node>& labels)
+	{
+		std::string bytes;
+		auto append = [&bytes](const void* data, const std::size_t size) {
+			bytes.append(static_cast<const char*>(data), size);
+		};
+		for (const auto& label : labels) {
+			std::uint8_t tag = static_cast<std::uint8_t>(label.index());
+			append(&tag, sizeof(tag));
+			if (auto value = std::get_if<int>(&label)) {
+				std::int64_t integer = *value;
+				append(&integer, sizeof(integer));
+			} else {
+				const auto& text = std::get<std::string>(label);
+				std::uint64_t length = text.size();
+				append(&length, sizeof(length));
+				append(text.data(), text.size());
+			}
+		}
+		return bytes;
+	}
+
+	std::vector<Node> decodeLabels(const char* data, const std::size_t size, const std::size_t numNodes)
+	{
+		std::vector<Node> labels;
+		labels.reserve(numNodes);
+		std::size_t position = 0;
+		auto read = [data, size, &position](void* out, const std::size_t bytes) {
+			if (bytes > size - position)
+				throw std::runtime_error("LoadModel: the node table is truncated.");
+			std::memcpy(out, data + position, bytes);
+			position += bytes;
+		};
+		for (std::size_t i = 0; i < numNodes; i++) {
+			std::uint8_t tag;
+			read(&tag, sizeof(tag));
+			if (tag == 0) {
+				std::int64_t integer;
+				read(&integer, sizeof(integer));
+				labels.emplace_back(static_cast<int>(integer));
+			} else {
+				std::uint64_t length;
+				read(&length, sizeof(length));
+				if (length > size - position)
+					throw std::runtime_error("LoadModel: the node table is truncated.");
+				labels.emplace_back(std::string(data + position, length));
+				position += length;
+			}
+		}
+		return labels;
+	}
+
+	// 型の異なるファイルの結合定数を、上三角成分を取り出して作り直す。
+	template<typename FileScalar, typename Scalar>
+	std::shared_ptr<const BasicCouplingMatrix<Scalar>> convertCouplings(const Header& header, const char* data)
+	{
+		std::vector<typename BasicCouplingMatrix<Scalar>::Triplet> upperTriangle;
+		auto append = [&upperTriangle](const std::size_t row, const std::size_t column, const FileScalar value) {
+			if (column < row || value == FileScalar(0))
+				return;
+			if constexpr (std::is_integral_v<Scalar>) {
+				auto real = static_cast<double>(value);
+				if (real != std::round(real) || real < std::numeric_limits<Scalar>::min() || real > std::numeric_limits<Scalar>::max())
+					throw std::invalid_argument("LoadModel: " + std::to_string(real) + " is not representable by the scalar type.");
+			}
+			upperTriangle.push_back({ row, column, static_cast<Scalar>(value) });
+		};
+		auto size = static_cast<std::size_t>(header.numNodes);
+		auto values = reinterpret_cast<const FileScalar*>(data + header.valuesOffset);
+		if (header.isSparse) {
+			auto rowOffsets = reinterpret_cast<const std::int64_t*>(data + header.rowOffsetsOffset);
+			auto columnIndices = reinterpret_cast<const std::int32_t*>(data + header.columnIndicesOffset);
+			for (std::size_t row = 0; row < size; row++)
+				for (auto k = rowOffsets[row]; k < rowOffsets[row + 1]; k++)
+					append(row, static_cast<std::size_t>(columnIndices[k]), values[k]);
+		} else {
+			for (std::size_t column = 0; column < size; column++)
+				for (std::size_t row = 0; row < size; row++)
+					append(row, column, values[column * size + row]);
+		}
+		return std::make_shared<const BasicCouplingMatrix<Scalar>>(size, upperTriangle);
+	}
+
+	// 負の添字を弾くために、符号付きで読んでから確かめる。
+	std::size_t toIndex(const long long value, const std::size_t numNodes, const char* caller)
+	{
+		if (value < 0 || static_cast<unsigned long long>(value) >= numNodes)
+			throw std::runtime_error(std::string(caller) + ": node index " + std::to_string(value) + " is out of range.");
+		return static_cast<std::size_t>(value);
+	}
+}
+
+template<typename Scalar>
+void Simulator::SaveModel(const BasicIsingModel<Scalar>& isingModel, const std::string& path)
+{
+	auto couplingCoefficients = isingModel.GetCouplingMatrix();
+	Eigen::VectorXd field = isingModel.GetExternalMagneticField();
+	auto labels = encodeLabels(isingModel.GetNodeLabels());
+	std::uint64_t size = couplingCoefficients->Size();
+
+	Header header{};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.byteOrderMark = ByteOrderMark;
+	header.scalarType = scalarTypeOf<Scalar>();
+	header.isSparse = couplingCoefficients->IsSparse() ? 1 : 0;
+	header.numNodes = size;
+	header.numNonZeros = header.isSparse ? couplingCoefficients->NonZeros() : size * size;
+	std::uint64_t offset = alignUp(sizeof(Header));
+	header.fieldOffset = offset;
+	offset = alignUp(offset + size * sizeof(double));
+	if (header.isSparse) {
+		header.rowOffsetsOffset = offset;
+		offset = alignUp(offset + (size + 1) * sizeof(std::int64_t));
+		header.columnIndicesOffset = offset;
+		offset = alignUp(offset + header.numNonZeros * sizeof(std::int32_t));
+	}
+	header.valuesOffset = offset;
+	offset += header.numNonZeros * sizeof(Scalar);
+	if (!labels.empty()) {
+		offset = alignUp(offset);
+		header.labelsOffset = offset;
+		offset += labels.size();
+	}
+	header.fileSize = offset;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("SaveModel: cannot open " + path);
+	std::uint64_t position = 0;
+	auto writeAt = [&file, &position](const std::uint64_t offset, const void* data, const std::uint64_t bytes) {
+		static const char padding[Alignment] = {};
+		file.write(padding, static_cast<std::streamsize>(offset - position));
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+		position = offset + bytes;
+	};
+	writeAt(0, &header, sizeof(header));
+	writeAt(header.fieldOffset, field.data(), size * sizeof(double));
+	if (header.isSparse) {
+		writeAt(header.rowOffsetsOffset, couplingCoefficients->RowOffsets(), (size + 1) * sizeof(std::int64_t));
+		writeAt(header.columnIndicesOffset, couplingCoefficients->ColumnIndices(), header.numNonZeros * sizeof(std::int32_t));
+		writeAt(header.valuesOffset, couplingCoefficients->Values(), header.numNonZeros * sizeof(Scalar));
+	} else {
+		writeAt(header.valuesOffset, couplingCoefficients->DenseData(), header.numNonZeros * sizeof(Scalar));
+	}
+	if (!labels.empty())
+		writeAt(header.labelsOffset, labels.data(), labels.size());
+	if (!file)
+		throw std::runtime_error("SaveModel: failed to write " + path);
+}
+
+// 配列の中身は検査しないので、SaveModelで書いたファイルだけを読むこと。
+template<typename Scalar>
+BasicIsingModel<Scalar> Simulator::LoadModel(const std::string& path)
+{
+	auto file = std::make_shared<const MappedFile>(path);
+	const char* data = file->Data();
+	Header header;
+	if (file->Size() < sizeof(Header))
+		throw std::runtime_error("LoadModel: " + path + " is too short.");
+	std::memcpy(&header, data, sizeof(Header));
+	if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version)
+		throw std::runtime_error("LoadModel: " + path + " is not a model file of this version.");
+	if (header.byteOrderMark != ByteOrderMark)
+		throw std::runtime_error("LoadModel: " + path + " was written with a different byte order.");
+	if (scalarSizeOf(header.scalarType) == 0)
+		throw std::runtime_error("LoadModel: " + path + " has an unknown scalar type.");
+	auto size = static_cast<std::size_t>(header.numNodes);
+	auto isInside = [&header](const std::uint64_t offset, const std::uint64_t count, const std::uint64_t elementSize) {
+		return offset <= header.fileSize && count <= (header.fileSize - offset) / elementSize;
+	};
+	if (header.fileSize != file->Size() || !isInside(header.fieldOffset, header.numNodes, sizeof(double))
+		|| !isInside(header.valuesOffset, header.numNonZeros, scalarSizeOf(header.scalarType)) || header.labelsOffset > header.fileSize
+		|| (header.isSparse && (!isInside(header.rowOffsetsOffset, header.numNodes + 1, sizeof(std::int64_t))
+			|| !isInside(header.columnIndicesOffset, header.numNonZeros, sizeof(std::int32_t))))
+		|| (!header.isSparse && header.numNonZeros != header.numNodes * header.numNodes))
+		throw std::runtime_error("LoadModel: " + path + " is corrupted.");
+
+	Eigen::VectorXd linear(size);
+	std::memcpy(linear.data(), data + header.fieldOffset, size * sizeof(double));
+	std::shared_ptr<const BasicCouplingMatrix<Scalar>> couplingCoefficients;
+	if (header.scalarType == scalarTypeOf<Scalar>()) {
+		auto values = reinterpret_cast<const Scalar*>(data + header.valuesOffset);
+		if (header.isSparse) {
+			auto rowOffsets = reinterpret_cast<const std::int64_t*>(data + header.rowOffsetsOffset);
+			if (rowOffsets[0] != 0 || static_cast<std::uint64_t>(rowOffsets[size]) != header.numNonZeros)
+				throw std::runtime_error("LoadModel: " + path + " is corrupted.");
+			couplingCoefficients = std::make_shared<const BasicCouplingMatrix<Scalar>>(size, rowOffsets,
+				reinterpret_cast<const std::int32_t*>(data + header.columnIndicesOffset), values, file);
+		} else {
+			couplingCoefficients = std::make_shared<const BasicCouplingMatrix<Scalar>>(size, values, file);
+		}
+	} else {
+		switch (header.scalarType) {
+		case ScalarTypes::Float64:
+			couplingCoefficients = convertCouplings<double, Scalar>(header, data);
+			break;
+		case ScalarTypes::Float32:
+			couplingCoefficients = convertCouplings<float, Scalar>(header, data);
+			break;
+		case ScalarTypes::Int16:
+			couplingCoefficients = convertCouplings<std::int16_t, Scalar>(header, data);
+			break;
+		default:
+			couplingCoefficients = convertCouplings<std::int8_t, Scalar>(header, data);
+			break;
+		}
+	}
+	std::vector<Node> labels;
+	if (header.labelsOffset > 0)
+		labels = decodeLabels(data + header.labelsOffset, header.fileSize - header.labelsOffset, size);
+	return BasicIsingModel<Scalar>(linear, couplingCoefficients, labels);
+}
+
+template<typename Scalar>
+BasicIsingModel<Scalar> Simulator::ImportGset(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("ImportGset: cannot open " + path);
+	std::size_t numNodes, numEdges;
+	if (!(file >> numNodes >> numEdges))
+		throw std::runtime_error("ImportGset: " + path + " has no header line.");
+	std::vector<std::size_t> rows, columns;
+	std::vector<double> weights;
+	rows.reserve(numEdges);
+	columns.reserve(numEdges);
+	weights.reserve(numEdges);
+	long long i, j;
+	double weight;
+	while (file >> i >> j >> weight) {
+		rows.push_back(toIndex(i - 1, numNodes, "ImportGset"));
+		columns.push_back(toIndex(j - 1, numNodes, "ImportGset"));
+		weights.push_back(-weight);
+	}
+	if (!file.eof())
+		throw std::runtime_error("ImportGset: " + path + " has a malformed edge line.");
+	return BasicIsingModel<Scalar>::FromCoo(Eigen::VectorXd::Zero(numNodes), rows, columns, weights);
+}
+
+// Q_{ij} x_i x_j = Q_{ij} (1 + s_i + s_j + s_i s_j) / 4, Q_{ii} x_i = Q_{ii} (1 + s_i) / 2.
+template<typename Scalar>
+BasicIsingModel<Scalar> Simulator::ImportQubo(const std::string& path, double* energyOffset)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("ImportQubo: cannot open " + path);
+	std::vector<std::size_t> rows, columns;
+	std::vector<double> weights, linear;
+	auto numNodes = std::numeric_limits<std::size_t>::max();
+	double offset = 0.e0;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream stream(line);
+		std::string first;
+		if (!(stream >> first) || first[0] == 'c')
+			continue;
+		if (first == "p") {
+			std::string format, topology;
+			if (!(stream >> format >> topology >> numNodes) || format != "qubo")
+				throw std::runtime_error("ImportQubo: malformed problem line: " + line);
+			continue;
+		}
+		std::istringstream entry(line);
+		long long i, j;
+		double value;
+		if (!(entry >> i >> j >> value))
+			throw std::runtime_error("ImportQubo: malformed line: " + line);
+		auto row = toIndex(i, numNodes, "ImportQubo");
+		auto column = toIndex(j, numNodes, "ImportQubo");
+		if (linear.size() <= std::max(row, column))
+			linear.resize(std::max(row, column) + 1, 0.e0);
+		if (row == column) {
+			linear[row] -= 0.5e0 * value;
+			offset += 0.5e0 * value;
+		} else {
+			rows.push_back(row);
+			columns.push_back(column);
+			weights.push_back(-0.25e0 * value);
+			linear[row] -= 0.25e0 * value;
+			linear[column] -= 0.25e0 * value;
+			offset += 0.25e0 * value;
+		}
+	}
+	if (numNodes != std::numeric_limits<std::size_t>::max())
+		linear.resize(numNodes, 0.e0);
+	if (energyOffset)
+		*energyOffset = offset;
+	return BasicIsingModel<Scalar>::FromCoo(Eigen::Map<const Eigen::VectorXd>(linear.data(), linear.size()), rows, columns, weights);
+}
+
+template void Simulator::SaveModel(const BasicIsingModel<double>&, const std::string&);
+template void Simulator::SaveModel(const BasicIsingModel<float>&, const std::string&);
+template void Simulator::SaveModel(const BasicIsingModel<std::int16_t>&, const std::string&);
+template void Simulator::SaveModel(const BasicIsingModel<std::int8_t>&, const std::string&);
+template BasicIsingModel<double> Simulator::LoadModel(const std::string&);
+template BasicIsingModel<float> Simulator::LoadModel(const std::string&);
+template BasicIsingModel<std::int16_t> Simulator::LoadModel(const std::string&);
+template BasicIsingModel<std::int8_t> Simulator::LoadModel(const std::string&);
+template BasicIsingModel<double> Simulator::ImportGset(const std::string&);
+template BasicIsingModel<float> Simulator::ImportGset(const std::string&);
+template BasicIsingModel<std::int16_t> Simulator::ImportGset(const std::string&);
+template BasicIsingModel<std::int8_t> Simulator::ImportGset(const std::string&);
+template BasicIsingModel<double> Simulator::ImportQubo(const std::string&, double*);
+template BasicIsingModel<float> Simulator::ImportQubo(const std::string&, double*);
+template BasicIsingModel<std::int16_t> Simulator::ImportQubo(const std::string&, double*);
+template BasicIsingModel<std::int8_t> Simulator::ImportQubo(const std::string&, double*);
@@ -0,0 +1,32 @@
+﻿#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include "simulator.h"
+#include <string>
+
+namespace Simulator {
+	// 二値形式のモデルファイル。書いた環境と同じバイト順の環境で読む。
+	// ヘッダの後に、以下の配列を64バイト境界に揃えて置く。
+	//   外部磁場 double[N]
+	//   結合定数 密行列ならば Scalar[N * N]（列優先）、CSR形式ならば int64[N + 1], int32[nnz], Scalar[nnz]
+	//   頂点の名前（任意） 頂点毎に、整数ならば 0 と int64、文字列ならば 1 と uint64 の長さとバイト列
+	// 読み込みではファイルを写像し、結合定数の型が一致すれば、写像した領域をそのまま結合定数として使う。
+	// 型が異なる場合は変換して読み込む（整数型で表せない値があれば例外を投げる）。
+	template<typename Scalar>
+	void SaveModel(const BasicIsingModel<Scalar>& isingModel, const std::string& path);
+
+	template<typename Scalar>
+	BasicIsingModel<Scalar> LoadModel(const std::string& path);
+
+	// Gset（rudy）形式: 1行目に頂点数と辺の数、続いて1始まりの頂点番号の組と重み "i j w" を1行に1つ。
+	// J_{ij} = -w_{ij} とするので、エネルギーHの最小化が最大カットに対応する: カットの重み = (sum_{ij} w_{ij} - H) / 2.
+	template<typename Scalar>
+	BasicIsingModel<Scalar> ImportGset(const std::string& path);
+
+	// qbsolv形式のQUBO: 'c' で始まる行は注釈、"p qubo topology maxNodes nNodes nCouplers" の後に0始まりの "i j Q_ij" を1行に1つ。
+	// p行がなければ頂点数は最大の添字から決める。x_i = (1 + s_i) / 2 と置き換え、x^T Q x = H(s) + energyOffset となるモデルを作る。
+	template<typename Scalar>
+	BasicIsingModel<Scalar> ImportQubo(const std::string& path, double* energyOffset = nullptr);
+}
+
+#endif // !MODEL_FILE_H
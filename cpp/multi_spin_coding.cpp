@@ -0,0 +1,197 @@
+﻿#include "multi_spin_coding.h"
+#include <stdexcept>
+
+using namespace Simulator;
+
+// 結合定数、外部磁場、温度、アルゴリズムとスピン配位をisingModelから引き継ぐ。全レプリカは同じ配位から始まる。
+// 対応しないアルゴリズムならば例外を投げる。
+MultiSpinCodedModel::MultiSpinCodedModel(const IsingModel& isingModel, const std::size_t numReplicas)
+	: rand(std::make_unique<Rand>())
+	, temperature(isingModel.GetTemperature())
+	, algorithm(checkAlgorithm(isingModel.GetCurrentAlgorithm()))
+	, numNodes(isingModel.GetSpins().size())
+	, numReplicas(numReplicas)
+	, numWords((numReplicas + WordSize - 1) / WordSize)
+	, numEdges(0)
+	, constantEnergy(0.e0)
+{
+	auto couplingCoefficients = isingModel.GetCouplingMatrix();
+	std::size_t maxDegree = 0;
+	rowOffsets.push_back(0);
+	for (std::size_t i = 0; i < numNodes; i++) {
+		couplingCoefficients->ForEachInRow(i, [this, i](const std::size_t j, const double value) {
+			if (i == j) {  // 対角成分はエネルギーを定数だけずらすだけ。
+				constantEnergy -= 0.5e0 * value;
+				return;
+			}
+			if (value != 1.e0 && value != -1.e0)
+				throw std::invalid_argument("MultiSpinCodedModel: coupling coefficients must be -1, 0 or +1.");
+			neighbors.push_back(static_cast<std::int32_t>(j));
+			antiferromagnetic.push_back((value < 0.e0) ? ~Word(0) : Word(0));
+			if (i < j)
+				numEdges++;
+		});
+		rowOffsets.push_back(static_cast<std::int64_t>(neighbors.size()));
+		maxDegree = std::max(maxDegree, static_cast<std::size_t>(rowOffsets[i + 1] - rowOffsets[i]));
+	}
+
+	int maxField = 0;
+	for (const auto value : isingModel.GetExternalMagneticField()) {
+		if (value != std::round(value))
+			throw std::invalid_argument("MultiSpinCodedModel: external magnetic fields must be integers.");
+		externalMagneticField.push_back(static_cast<int>(value));
+		maxField = std::max(maxField, std::abs(externalMagneticField.back()));
+	}
+	numCountingBits = 1;
+	while ((std::size_t(1) << numCountingBits) <= maxDegree)
+		numCountingBits++;
+	maxEnergyDifference = static_cast<int>(maxDegree) + maxField;
+
+	auto initialSpins = isingModel.GetSpins();
+	spins.resize(numNodes * numWords);
+	for (std::size_t i = 0; i < numNodes; i++)
+		for (std::size_t w = 0; w < numWords; w++)
+			spins[i * numWords + w] = (initialSpins(i) < 0) ? laneMask(w) : Word(0);
+	updateAcceptanceTable();
+}
+
+void MultiSpinCodedModel::GiveSpins(const IsingModel::ConfigurationsType configurationType)
+{
+	for (std::size_t i = 0; i < numNodes; i++) {
+		for (std::size_t w = 0; w < numWords; w++) {
+			switch (configurationType) {
+			case IsingModel::ConfigurationsType::AllDown:
+				spins[i * numWords + w] = laneMask(w);
+				break;
+			case IsingModel::ConfigurationsType::AllUp:
+				spins[i * numWords + w] = Word(0);
+				break;
+			case IsingModel::ConfigurationsType::Uniform:
+				spins[i * numWords + w] = (*rand)() & laneMask(w);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+// 頂点を順に1回ずつ、全レプリカで同時に更新する。
+// 頂点iを反転したときのエネルギー差は、満たされない結合の数をu、次数をdとして ΔE / 2 = d - 2u + h_i s_i.
+void MultiSpinCodedModel::Sweep()
+{
+	std::vector<Word> planes(numCountingBits);
+	std::uint64_t randomBits = 0;
+	bool hasRandomBits = false;
+	auto draw = [this, &randomBits, &hasRandomBits]() -> std::uint64_t {  // 64ビットの乱数を32ビットずつ使う。
+		hasRandomBits = !hasRandomBits;
+		if (hasRandomBits) {
+			randomBits = (*rand)();
+			return randomBits & 0xffffffffu;
+		}
+		return randomBits >> 32;
+	};
+
+	for (std::size_t i = 0; i < numNodes; i++) {
+		int degree = static_cast<int>(rowOffsets[i + 1] - rowOffsets[i]);
+		for (std::size_t w = 0; w < numWords; w++) {
+			Word self = spins[i * numWords + w];
+			std::fill(planes.begin(), planes.end(), Word(0));
+			for (auto k = rowOffsets[i]; k < rowOffsets[i + 1]; k++)
+				addToCounter(planes, self ^ spins[neighbors[k] * numWords + w] ^ antiferromagnetic[k]);
+			// u毎に該当するレーンをまとめ、確率が0か1の所は乱数を使わずに決める。
+			Word flips = 0;
+			Word remaining = laneMask(w);
+			for (int unsatisfied = 0; unsatisfied <= degree && remaining != 0; unsatisfied++) {
+				Word lanes = remaining;
+				for (std::size_t p = 0; p < planes.size(); p++)
+					lanes &= ((unsatisfied >> p) & 1) ? planes[p] : ~planes[p];
+				remaining &= ~lanes;
+				for (const int spin : { +1, -1 }) {
+					Word subset = lanes & ((spin > 0) ? ~self : self);
+					auto threshold = acceptanceThresholds[degree - 2 * unsatisfied + externalMagneticField[i] * spin + maxEnergyDifference];
+					if (subset == 0 || threshold == 0)
+						continue;
+					if (threshold >= Certain) {
+						flips |= subset;
+						continue;
+					}
+					for (; subset != 0; subset &= subset - 1)  // 立っている最下位ビットから順に。
+						if (draw() < threshold)
+							flips |= subset & (~subset + 1);
+				}
+			}
+			spins[i * numWords + w] = self ^ flips;
+		}
+	}
+}
+
+// E = sum_{i < j} (2 [結合が満たされない] - 1) - sum_i h_i (1 - 2 b_i) + 定数, where b_i = 1 iff s_i = -1.
+Eigen::VectorXd MultiSpinCodedModel::GetEnergies() const
+{
+	Eigen::VectorXd energies(numReplicas);
+	std::vector<Word> planes(32);
+	double totalField = 0.e0;
+	for (const auto h : externalMagneticField)
+		totalField += h;
+	for (std::size_t w = 0; w < numWords; w++) {
+		std::fill(planes.begin(), planes.end(), Word(0));
+		for (std::size_t i = 0; i < numNodes; i++) {
+			Word self = spins[i * numWords + w];
+			for (auto k = rowOffsets[i]; k < rowOffsets[i + 1]; k++)
+				if (static_cast<std::size_t>(neighbors[k]) > i)
+					addToCounter(planes, self ^ spins[neighbors[k] * numWords + w] ^ antiferromagnetic[k]);
+		}
+		for (std::size_t lane = 0; lane < WordSize && w * WordSize + lane < numReplicas; lane++) {
+			double energy = 2.e0 * readCounter(planes, lane) - static_cast<double>(numEdges) - totalField + constantEnergy;
+			for (std::size_t i = 0; i < numNodes; i++)
+				if (externalMagneticField[i] != 0 && ((spins[i * numWords + w] >> lane) & 1))
+					energy += 2.e0 * externalMagneticField[i];
+			energies(w * WordSize + lane) = energy;
+		}
+	}
+	return energies;
+}
+
+// 全レプリカについての和はpopcountだけで求まる。
+double MultiSpinCodedModel::GetMeanEnergy() const
+{
+	double sum = 0.e0;
+	for (std::size_t i = 0; i < numNodes; i++) {
+		for (std::size_t w = 0; w < numWords; w++) {
+			Word self = spins[i * numWords + w];
+			for (auto k = rowOffsets[i]; k < rowOffsets[i + 1]; k++)
+				if (static_cast<std::size_t>(neighbors[k]) > i)
+					sum += 2.e0 * popCount((self ^ spins[neighbors[k] * numWords + w] ^ antiferromagnetic[k]) & laneMask(w));
+			sum += externalMagneticField[i] * (2.e0 * popCount(self) - static_cast<double>(std::min(WordSize, numReplicas - w * WordSize)));
+		}
+	}
+	return sum / numReplicas - static_cast<double>(numEdges) + constantEnergy;
+}
+
+Eigen::VectorXi MultiSpinCodedModel::GetSpins(const std::size_t replica) const
+{
+	if (replica >= numReplicas)
+		throw std::out_of_range("MultiSpinCodedModel: replica index out of range.");
+	Eigen::VectorXi result(numNodes);
+	for (std::size_t i = 0; i < numNodes; i++)
+		result(i) = ((spins[i * numWords + replica / WordSize] >> (replica % WordSize)) & 1) ? -1 : +1;
+	return result;
+}
+
+// Metropolis: min(1, exp(-ΔE / T)), Glauber: 1 / (1 + exp(ΔE / T)).
+void MultiSpinCodedModel::updateAcceptanceTable()
+{
+	acceptanceThresholds.resize(2 * maxEnergyDifference + 1);
+	for (int halfDifference = -maxEnergyDifference; halfDifference <= maxEnergyDifference; halfDifference++) {
+		double energyDifference = 2.e0 * halfDifference;
+		double probability;
+		if (temperature <= 0.e0)
+			probability = (energyDifference < 0.e0) ? 1.e0 : (energyDifference > 0.e0) ? 0.e0 : (algorithm == Algorithms::Glauber) ? 0.5e0 : 1.e0;
+		else if (algorithm == Algorithms::Glauber)
+			probability = 1.e0 / (1.e0 + std::exp(energyDifference / temperature));
+		else
+			probability = (energyDifference <= 0.e0) ? 1.e0 : std::exp(-energyDifference / temperature);
+		acceptanceThresholds[halfDifference + maxEnergyDifference] = static_cast<std::uint64_t>(std::llround(probability * Certain));
+	}
+}
@@ -0,0 +1,127 @@
+﻿#ifndef MULTI_SPIN_CODING_H
+#define MULTI_SPIN_CODING_H
+
+#include "simulator.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Simulator {
+	// 結合定数が {-1, 0, +1}、外部磁場が整数のモデル専用の多スピンコーディング。
+	// 64個のレプリカの同じ頂点のスピンを1語のビットに詰め（1が下向き）、
+	// 満たされない結合の数をXORとビットスライスの加算で全レプリカ同時に数える。
+	// エネルギー差は整数なので、採択確率は温度を設定したときに表にしておく。
+	// MetropolisとGlauberのみに対応する。
+	class MultiSpinCodedModel {
+	public:
+		MultiSpinCodedModel(const IsingModel& isingModel, const std::size_t numReplicas);
+		void GiveSpins(const IsingModel::ConfigurationsType configurationType);
+		void Sweep();
+		Eigen::VectorXd GetEnergies() const;
+		double GetMeanEnergy() const;
+		Eigen::VectorXi GetSpins(const std::size_t replica) const;
+
+		std::size_t GetNumReplicas() const
+		{
+			return numReplicas;
+		}
+
+		Algorithms GetCurrentAlgorithm() const
+		{
+			return algorithm;
+		}
+
+		void ChangeAlgorithmTo(const Algorithms algorithm)
+		{
+			this->algorithm = checkAlgorithm(algorithm);
+			updateAcceptanceTable();
+		}
+
+		double GetTemperature() const
+		{
+			return temperature;
+		}
+
+		void SetTemperature(const double temperature)
+		{
+			this->temperature = std::max(temperature, 0.e0);
+			updateAcceptanceTable();
+		}
+
+		void SetSeed()
+		{
+			rand = std::make_unique<Rand>();
+		}
+
+		void SetSeed(const unsigned int seed)
+		{
+			SetSeed();
+			rand->Seed(seed);
+		}
+	private:
+		using Word = std::uint64_t;
+		static constexpr std::size_t WordSize = 64;
+		static constexpr std::uint64_t Certain = std::uint64_t(1) << 32;  // 確率1に対応する閾値。
+
+		std::unique_ptr<Rand> rand;
+		double temperature;
+		Algorithms algorithm;
+		std::size_t numNodes;
+		std::size_t numReplicas;
+		std::size_t numWords;            // 1頂点あたりの語数 = ceil(numReplicas / 64).
+		std::vector<Word> spins;         // spins[i * numWords + w] の第lビットは、レプリカ 64 w + l の頂点iのスピン。
+		std::vector<std::int64_t> rowOffsets;
+		std::vector<std::int32_t> neighbors;
+		std::vector<Word> antiferromagnetic;  // J_{ij} = -1 ならば全ビット1、+1 ならば0。
+		std::vector<int> externalMagneticField;
+		std::size_t numEdges;            // J_{ij} != 0 (i < j) の個数。
+		double constantEnergy;           // 対角成分の寄与 -sum_i J_{ii} / 2.
+		std::size_t numCountingBits;     // 次数の最大値を表すのに必要なビット数。
+		int maxEnergyDifference;         // |ΔE / 2| の上限。
+		std::vector<std::uint64_t> acceptanceThresholds;  // 添字 ΔE / 2 + maxEnergyDifference. 一様な32ビット乱数がこれ未満ならば反転する。
+
+		void updateAcceptanceTable();
+
+		static Algorithms checkAlgorithm(const Algorithms algorithm)
+		{
+			if (algorithm != Algorithms::Metropolis && algorithm != Algorithms::Glauber)
+				throw std::invalid_argument("MultiSpinCodedModel: only Metropolis and Glauber are supported.");
+			return algorithm;
+		}
+
+		Word laneMask(const std::size_t w) const
+		{
+			auto lanes = std::min(WordSize, numReplicas - w * WordSize);
+			return (lanes == WordSize) ? ~Word(0) : (Word(1) << lanes) - 1;
+		}
+
+		// 縦に並べたビット列 planes にビット列 x の各ビットを1ずつ加える。
+		static void addToCounter(std::vector<Word>& planes, Word x)
+		{
+			for (std::size_t p = 0; x != 0 && p < planes.size(); p++) {
+				Word carry = planes[p] & x;
+				planes[p] ^= x;
+				x = carry;
+			}
+		}
+
+		static int popCount(const Word x)
+		{
+#ifdef _MSC_VER
+			return static_cast<int>(__popcnt64(x));
+#else
+			return __builtin_popcountll(x);
+#endif
+		}
+
+		static std::uint64_t readCounter(const std::vector<Word>& planes, const std::size_t lane)
+		{
+			std::uint64_t result = 0;
+			for (std::size_t p = 0; p < planes.size(); p++)
+				result |= ((planes[p] >> lane) & 1) << p;
+			return result;
+		}
+	};
+}
+
+#endif // !MULTI_SPIN_CODING_H
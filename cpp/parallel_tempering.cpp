@@ -0,0 +1,144 @@
+﻿#include "parallel_tempering.h"
+#include <numeric>
+
+using namespace Simulator;
+
+ParallelTempering::ParallelTempering(const IsingModel& isingModel, const std::vector<double>& temperatures, const std::size_t numThreads)
+	: threadPool(numThreads)
+	, round(0)
+	, bestEnergy(isingModel.GetEnergy())
+	, bestSpins(isingModel.GetSpins())
+{
+	checkTemperatures(temperatures);
+	replicas.reserve(temperatures.size());
+	for (std::size_t k = 0; k < temperatures.size(); k++) {
+		replicas.push_back(isingModel);
+		replicaIndices.push_back(k);
+	}
+	setTemperatures(temperatures);
+	ResetStatistics();
+}
+
+void ParallelTempering::Run(const std::size_t rounds, const std::size_t stepsPerRound, const std::size_t tuningInterval)
+{
+	RunOptions options;
+	options.stepUnit = StepUnits::Sweep;
+	for (std::size_t n = 0; n < rounds; n++) {
+		threadPool.ParallelFor(replicas.size(), [this, stepsPerRound, &options](const std::size_t k) {
+			replicas[k].Run(stepsPerRound, options);
+		});
+		for (const auto& replica : replicas) {
+			if (replica.GetEnergy() < bestEnergy) {
+				bestEnergy = replica.GetEnergy();
+				bestSpins = replica.GetSpins();
+			}
+		}
+		exchange();
+		round++;
+		if (tuningInterval > 0 && round % tuningInterval == 0)
+			TuneTemperatures();
+	}
+}
+
+// 隣り合う段の温度の逆数の差を、交換の採択率が高い所では広げ、低い所では狭める。両端の温度は変えない。
+void ParallelTempering::TuneTemperatures()
+{
+	if (temperatures.size() < 3)
+		return;
+	const double regularization = 5.e-2;
+	std::vector<double> rates(temperatures.size() - 1);
+	for (std::size_t k = 0; k < rates.size(); k++)
+		rates[k] = (recentSwapAttempts[k] > 0) ? static_cast<double>(recentSwapAcceptances[k]) / recentSwapAttempts[k] : 0.e0;
+	double meanRate = std::accumulate(rates.begin(), rates.end(), 0.e0) / rates.size();
+
+	std::vector<double> gaps(rates.size());
+	double totalGap = 0.e0, totalNextGap = 0.e0;
+	for (std::size_t k = 0; k < gaps.size(); k++) {
+		double gap = 1.e0 / temperatures[k] - 1.e0 / temperatures[k + 1];
+		gaps[k] = gap * (rates[k] + regularization) / (meanRate + regularization);
+		totalGap += gap;
+		totalNextGap += gaps[k];
+	}
+	std::vector<double> nextTemperatures(temperatures);
+	double beta = 1.e0 / temperatures.front();
+	for (std::size_t k = 0; k + 2 < temperatures.size(); k++) {
+		beta -= gaps[k] * totalGap / totalNextGap;
+		nextTemperatures[k + 1] = 1.e0 / beta;
+	}
+	setTemperatures(nextTemperatures);
+	std::fill(recentSwapAttempts.begin(), recentSwapAttempts.end(), 0);
+	std::fill(recentSwapAcceptances.begin(), recentSwapAcceptances.end(), 0);
+}
+
+void ParallelTempering::ResetStatistics()
+{
+	auto numPairs = (replicas.size() > 0) ? replicas.size() - 1 : 0;
+	swapAttempts.assign(numPairs, 0);
+	swapAcceptances.assign(numPairs, 0);
+	recentSwapAttempts.assign(numPairs, 0);
+	recentSwapAcceptances.assign(numPairs, 0);
+}
+
+// シードは共通で、交換の判定にはストリーム0を、k番目のレプリカにはストリーム k + 1 を使う。
+void ParallelTempering::SetSeed(const unsigned int seed)
+{
+	rand.Seed(seed, 0);
+	for (std::size_t k = 0; k < replicas.size(); k++)
+		replicas[k].SetSeed(seed, k + 1);
+}
+
+// 温度の低い順。
+Eigen::VectorXd ParallelTempering::GetEnergies() const
+{
+	Eigen::VectorXd energies(replicas.size());
+	for (std::size_t k = 0; k < replicas.size(); k++)
+		energies(k) = replicas[replicaIndices[k]].GetEnergy();
+	return energies;
+}
+
+// k番目の成分は温度の段 k と k + 1 の間の交換の採択率。
+Eigen::VectorXd ParallelTempering::GetSwapRates() const
+{
+	Eigen::VectorXd rates(swapAttempts.size());
+	for (std::size_t k = 0; k < swapAttempts.size(); k++)
+		rates(k) = (swapAttempts[k] > 0) ? static_cast<double>(swapAcceptances[k]) / swapAttempts[k] : 0.e0;
+	return rates;
+}
+
+// 偶数番目と奇数番目の組をラウンド毎に交互に試す。採択確率は min(1, exp((1/T_k - 1/T_{k+1})(E_k - E_{k+1}))).
+void ParallelTempering::exchange()
+{
+	for (auto k = round % 2; k + 1 < replicas.size(); k += 2) {
+		auto& lower = replicas[replicaIndices[k]];
+		auto& upper = replicas[replicaIndices[k + 1]];
+		double exponent = (1.e0 / temperatures[k] - 1.e0 / temperatures[k + 1]) * (lower.GetEnergy() - upper.GetEnergy());
+		swapAttempts[k]++;
+		recentSwapAttempts[k]++;
+		if (exponent >= 0.e0 || rand.Bernoulli(std::exp(exponent))) {
+			std::swap(replicaIndices[k], replicaIndices[k + 1]);
+			replicas[replicaIndices[k]].SetTemperature(temperatures[k]);
+			replicas[replicaIndices[k + 1]].SetTemperature(temperatures[k + 1]);
+			swapAcceptances[k]++;
+			recentSwapAcceptances[k]++;
+		}
+	}
+}
+
+void ParallelTempering::setTemperatures(const std::vector<double>& temperatures)
+{
+	checkTemperatures(temperatures);
+	this->temperatures = temperatures;
+	for (std::size_t k = 0; k < temperatures.size(); k++)
+		replicas[replicaIndices[k]].SetTemperature(temperatures[k]);
+}
+
+// 交換の確率は温度の逆数の差で決まるので、温度は正で狭義単調増加でなければならない。
+void ParallelTempering::checkTemperatures(const std::vector<double>& temperatures)
+{
+	for (std::size_t k = 0; k < temperatures.size(); k++) {
+		if (!(temperatures[k] > 0.e0))
+			throw std::invalid_argument("ParallelTempering: temperatures must be positive.");
+		if (k > 0 && !(temperatures[k - 1] < temperatures[k]))
+			throw std::invalid_argument("ParallelTempering: temperatures must be strictly ascending.");
+	}
+}
@@ -0,0 +1,68 @@
+﻿#ifndef PARALLEL_TEMPERING_H
+#define PARALLEL_TEMPERING_H
+
+#include "simulator.h"
+#include "thread_pool.h"
+
+namespace Simulator {
+	// レプリカ交換法。温度の梯子の各段にIsingModelの複製を1つずつ置き、
+	// スレッドプール上で並列に更新してから、隣り合う段の間で配位の交換を試みる。
+	class ParallelTempering {
+	public:
+		// temperaturesは正の値を昇順に並べる。そうでなければ std::invalid_argument を投げる。
+		ParallelTempering(const IsingModel& isingModel, const std::vector<double>& temperatures, const std::size_t numThreads = std::thread::hardware_concurrency());
+		// 1ラウンド = 各レプリカをstepsPerRoundステップ（MetropolisとGlauberはスイープ）だけ更新した後、交換を試行する。
+		// tuningIntervalが正ならば、そのラウンド数毎に温度の梯子を調整する。
+		void Run(const std::size_t rounds, const std::size_t stepsPerRound = 1, const std::size_t tuningInterval = 0);
+		void TuneTemperatures();
+		void ResetStatistics();
+		void SetSeed(const unsigned int seed);
+		Eigen::VectorXd GetEnergies() const;
+		Eigen::VectorXd GetSwapRates() const;
+
+		std::size_t GetNumReplicas() const
+		{
+			return replicas.size();
+		}
+
+		Eigen::VectorXd GetTemperatures() const
+		{
+			return Eigen::Map<const Eigen::VectorXd>(temperatures.data(), temperatures.size());
+		}
+
+		// k番目に低い温度にいるレプリカ。
+		const IsingModel& GetReplica(const std::size_t k) const
+		{
+			return replicas[replicaIndices[k]];
+		}
+
+		double GetBestEnergy() const
+		{
+			return bestEnergy;
+		}
+
+		Eigen::VectorXi GetBestSpins() const
+		{
+			return bestSpins;
+		}
+	private:
+		ThreadPool threadPool;
+		Rand rand;
+		std::vector<double> temperatures;
+		std::vector<IsingModel> replicas;
+		std::vector<std::size_t> replicaIndices;  // 温度の段 -> レプリカの番号。交換は配位ではなくこの対応を入れ替えて行う。
+		std::vector<std::size_t> swapAttempts;
+		std::vector<std::size_t> swapAcceptances;
+		std::vector<std::size_t> recentSwapAttempts;     // 前回の調整以降の試行回数。
+		std::vector<std::size_t> recentSwapAcceptances;
+		std::size_t round;
+		double bestEnergy;
+		Eigen::VectorXi bestSpins;
+
+		void exchange();
+		void setTemperatures(const std::vector<double>& temperatures);
+		static void checkTemperatures(const std::vector<double>& temperatures);
+	};
+}
+
+#endif // !PARALLEL_TEMPERING_H
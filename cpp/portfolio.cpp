@@ -0,0 +1,107 @@
+﻿#include "portfolio.h"
+#include <chrono>
+#include <exception>
+#include <limits>
+
+using namespace Simulator;
+
+Portfolio::Portfolio(const IsingModel& isingModel, const std::size_t numThreads)
+	: threadPool(numThreads)
+	, isingModel(isingModel)
+	, bestEnergy(std::numeric_limits<double>::infinity())
+{
+}
+
+std::size_t Portfolio::AddStrategy(const Strategy& strategy)
+{
+	strategies.push_back(strategy);
+	strategies.back().options.observables.clear();
+	strategies.back().options.snapshotInterval = 0;
+	strategies.back().options.trajectoryWriter.reset();
+	strategies.back().options.stepCallback = nullptr;
+	return strategies.size() - 1;
+}
+
+// 再出発毎に元のモデルを複製するので、互いに独立に実行できる。結合定数は共有する。
+// 各ステップの後にエネルギーを調べ、途中で到達した最良の配位を残す。
+void Portfolio::Run(const unsigned int seed)
+{
+	std::vector<std::size_t> tasks;
+	for (std::size_t s = 0; s < strategies.size(); s++)
+		tasks.insert(tasks.end(), strategies[s].restarts, s);
+	auto firstStream = static_cast<std::uint64_t>(restarts.size());
+	std::vector<Restart> results(tasks.size());
+	std::vector<Eigen::VectorXi> restartSpins(tasks.size());
+	std::vector<std::exception_ptr> errors(tasks.size());
+	threadPool.ParallelFor(tasks.size(), [&](const std::size_t k) {
+		try {
+			const auto& strategy = strategies[tasks[k]];
+			auto start = std::chrono::steady_clock::now();
+			IsingModel replica(isingModel);
+			replica.ChangeAlgorithmTo(strategy.algorithm);
+			if (strategy.pinningParameter)
+				replica.SetPinningParameter(*strategy.pinningParameter);
+			if (strategy.flipTrialRate)
+				replica.SetFlipTrialRate(*strategy.flipTrialRate);
+			replica.SetSeed(seed, firstStream + k + 1);
+			replica.GiveSpins(ConfigurationsType::Uniform);
+			double bestEnergy = replica.GetEnergy();
+			Eigen::VectorXi bestSpins = replica.GetSpins();
+			auto options = strategy.options;
+			options.stepCallback = [&replica, &bestEnergy, &bestSpins](const std::size_t) {
+				if (replica.GetEnergy() < bestEnergy) {
+					bestEnergy = replica.GetEnergy();
+					bestSpins = replica.GetSpins();
+				}
+				return true;
+			};
+			replica.Run(strategy.steps, options);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			results[k] = { tasks[k], firstStream + k + 1, replica.GetEnergy(), bestEnergy, seconds };
+			restartSpins[k] = std::move(bestSpins);
+		} catch (...) {
+			errors[k] = std::current_exception();
+		}
+	});
+	for (const auto& error : errors)
+		if (error)
+			std::rethrow_exception(error);
+	for (std::size_t k = 0; k < results.size(); k++) {
+		if (results[k].bestEnergy < bestEnergy) {
+			bestEnergy = results[k].bestEnergy;
+			bestSpins = restartSpins[k];
+		}
+	}
+	restarts.insert(restarts.end(), results.begin(), results.end());
+}
+
+double Portfolio::GetTargetEnergy() const
+{
+	return targetEnergy ? *targetEnergy : bestEnergy;
+}
+
+// エネルギーの比較には丸め誤差の分の余裕を持たせる。
+Portfolio::Statistics Portfolio::GetStatistics(const std::size_t strategy, const double targetProbability) const
+{
+	Statistics statistics{ 0, 0, 0.e0, 0.e0, std::numeric_limits<double>::infinity() };
+	double target = GetTargetEnergy();
+	double tolerance = 1.e-9 * std::max(1.e0, std::abs(target));
+	double totalSeconds = 0.e0;
+	for (const auto& restart : restarts) {
+		if (restart.strategy != strategy)
+			continue;
+		statistics.restarts++;
+		totalSeconds += restart.seconds;
+		if (restart.bestEnergy <= target + tolerance)
+			statistics.successes++;
+	}
+	if (statistics.restarts == 0)
+		return statistics;
+	statistics.successProbability = static_cast<double>(statistics.successes) / statistics.restarts;
+	statistics.meanSeconds = totalSeconds / statistics.restarts;
+	if (statistics.successes == statistics.restarts)
+		statistics.timeToSolution = statistics.meanSeconds;  // 1回で成功する。
+	else if (statistics.successes > 0)
+		statistics.timeToSolution = statistics.meanSeconds * std::max(1.e0, std::log(1.e0 - targetProbability) / std::log(1.e0 - statistics.successProbability));
+	return statistics;
+}
@@ -0,0 +1,82 @@
+﻿#ifndef PORTFOLIO_H
+#define PORTFOLIO_H
+
+#include "simulator.h"
+#include "thread_pool.h"
+
+namespace Simulator {
+	// 一様ランダムな配位からの独立な再出発を、複数の設定（戦略）についてまとめてスレッドプール上で実行する。
+	// 各再出発は途中で到達した最良のエネルギーで評価し、目標のエネルギー以下ならば成功とする（最後の配位が目標から外れていてもよい）。
+	// TTS(p) = t ln(1 - p) / ln(1 - P_s): 確率pで1回以上成功するのに要する時間。tは1回の再出発の平均時間、P_sは成功確率。
+	class Portfolio {
+	public:
+		struct Strategy {
+			Algorithms algorithm = Algorithms::Metropolis;
+			std::size_t steps = 1000;
+			RunOptions options;                       // 物理量の記録、trajectoryWriterとstepCallbackは使わない。
+			std::optional<double> pinningParameter;   // 指定しなければ元のモデルの値。
+			std::optional<double> flipTrialRate;
+			std::size_t restarts = 1;                 // Run 1回あたりの再出発の回数。
+		};
+
+		struct Restart {
+			std::size_t strategy;
+			std::uint64_t stream;  // 乱数のストリーム番号。同じシードとこの番号で再現できる。
+			double energy;      // 最後の配位のエネルギー。
+			double bestEnergy;  // 途中で到達した最良のエネルギー。成功の判定に使う。
+			double seconds;
+		};
+
+		struct Statistics {
+			std::size_t restarts;
+			std::size_t successes;
+			double successProbability;
+			double meanSeconds;
+			double timeToSolution;  // 成功が1回もなければ無限大。
+		};
+
+		Portfolio(const IsingModel& isingModel, const std::size_t numThreads = std::thread::hardware_concurrency());
+		std::size_t AddStrategy(const Strategy& strategy);
+		// 全戦略の再出発を実行して結果に加える。ストリーム番号は通し番号なので、同じシードで繰り返し呼んでも重ならない。
+		void Run(const unsigned int seed);
+		// targetProbabilityはTTSの確率p.
+		Statistics GetStatistics(const std::size_t strategy, const double targetProbability = 0.99) const;
+		// 目標のエネルギー。指定しなければ、これまでの最良値。
+		double GetTargetEnergy() const;
+
+		void SetTargetEnergy(const std::optional<double> targetEnergy)
+		{
+			this->targetEnergy = targetEnergy;
+		}
+
+		std::size_t GetNumStrategies() const
+		{
+			return strategies.size();
+		}
+
+		const std::vector<Restart>& GetRestarts() const
+		{
+			return restarts;
+		}
+
+		double GetBestEnergy() const
+		{
+			return bestEnergy;
+		}
+
+		Eigen::VectorXi GetBestSpins() const
+		{
+			return bestSpins;
+		}
+	private:
+		ThreadPool threadPool;
+		IsingModel isingModel;
+		std::vector<Strategy> strategies;
+		std::vector<Restart> restarts;
+		std::optional<double> targetEnergy;
+		double bestEnergy;
+		Eigen::VectorXi bestSpins;
+	};
+}
+
+#endif // !PORTFOLIO_H
@@ -0,0 +1,104 @@
+﻿#include "replica_batch.h"
+#include <limits>
+
+using namespace Simulator;
+
+// スピン配位以外（結合定数、外部磁場、アルゴリズム、パラメータ）はisingModelから引き継ぐ。対応しないアルゴリズムならば例外を投げる。
+ReplicaBatch::ReplicaBatch(const IsingModel& isingModel, const std::size_t numReplicas)
+	: temperatures(Eigen::VectorXd::Constant(numReplicas, isingModel.GetTemperature()))
+	, pinningParameter(isingModel.GetPinningParameter())
+	, flipTrialRate(isingModel.GetFlipTrialRate())
+	, algorithm(checkAlgorithm(isingModel.GetCurrentAlgorithm()))
+	, couplingCoefficients(isingModel.GetCouplingMatrix())
+	, externalMagneticField(isingModel.GetExternalMagneticField())
+{
+	for (std::size_t r = 0; r < numReplicas; r++)
+		rands.push_back(std::make_unique<Rand>());
+	spins = isingModel.GetSpins().cast<double>().replicate(1, numReplicas);
+	previousSpins = spins;
+	recalculateLocalMagneticFields();
+}
+
+Eigen::VectorXd ReplicaBatch::GetEnergies() const
+{
+	return -0.5e0 * spins.cwiseProduct(localMagneticFields.colwise() + externalMagneticField).colwise().sum().transpose();
+}
+
+// 各レプリカについて IsingModel::GetEnergyOnBipartiteGraph と同じ量。
+Eigen::VectorXd ReplicaBatch::GetEnergiesOnBipartiteGraph() const
+{
+	Eigen::VectorXd halfFieldDifferences = 0.5e0 * ((spins - previousSpins).transpose() * externalMagneticField);
+	Eigen::VectorXd overlaps = spins.cwiseProduct(previousSpins).colwise().sum().transpose();
+	return GetEnergies() + halfFieldDifferences + 0.5e0 * pinningParameter * (spins.rows() - overlaps.array()).matrix();
+}
+
+void ReplicaBatch::GiveSpins(const IsingModel::ConfigurationsType configurationType)
+{
+	switch (configurationType) {
+	case IsingModel::ConfigurationsType::AllDown:
+		spins.fill(-1.e0);
+		break;
+	case IsingModel::ConfigurationsType::AllUp:
+		spins.fill(+1.e0);
+		break;
+	case IsingModel::ConfigurationsType::Uniform:
+		spins = generateNoise([](const std::uint64_t word) -> double { return (Rand::ToUniform(word) < 0.5e0) ? -1.e0 : +1.e0; });
+		break;
+	default:
+		break;
+	}
+	previousSpins = spins;
+	recalculateLocalMagneticFields();
+}
+
+void ReplicaBatch::SetSeed()
+{
+	for (auto& rand : rands)
+		rand = std::make_unique<Rand>();
+}
+
+// シードは共通で、r番目のレプリカにはストリーム r を使う。
+void ReplicaBatch::SetSeed(const unsigned int seed)
+{
+	for (std::size_t r = 0; r < rands.size(); r++)
+		rands[r] = std::make_unique<Rand>(seed, r);
+}
+
+void ReplicaBatch::Update()
+{
+	Eigen::MatrixXd nextSpins;
+	switch (algorithm) {
+	case Algorithms::SCA:
+		nextSpins = (
+			localMagneticFields + pinningParameter * spins
+			- generateNoise([](const std::uint64_t word) { return Rand::ToLogistic(word); }) * temperatures.asDiagonal()
+		).array().sign().matrix();
+		break;
+	case Algorithms::fcSCA:
+		nextSpins = (
+			localMagneticFields + pinningParameter * spins
+			- generateNoise([](const std::uint64_t word) { return Rand::ToLogistic(word); }) * temperatures.asDiagonal()
+			+ generateNoise([this](const std::uint64_t word) -> double {
+				return (Rand::ToUniform(word) < flipTrialRate) ? 0.e0 : std::numeric_limits<double>::infinity();
+			}).cwiseProduct(spins)
+		).array().sign().matrix();
+		break;
+	case Algorithms::MA:
+		nextSpins = (
+			localMagneticFields + pinningParameter * spins
+			- generateNoise([](const std::uint64_t word) { return Rand::ToExponential(word); }).cwiseProduct(previousSpins) * temperatures.asDiagonal()
+		).array().sign().matrix();
+		break;
+	case Algorithms::MMA:
+		nextSpins = (
+			localMagneticFields + pinningParameter * spins
+			- generateNoise([](const std::uint64_t word) { return Rand::ToExponential(word); }).cwiseProduct(spins) * temperatures.asDiagonal()
+		).array().sign().matrix();
+		break;
+	default:  // checkAlgorithmで除いている。
+		return;
+	}
+	previousSpins = spins;
+	spins = nextSpins;
+	recalculateLocalMagneticFields();
+}
@@ -0,0 +1,110 @@
+﻿#ifndef REPLICA_BATCH_H
+#define REPLICA_BATCH_H
+
+#include "simulator.h"
+
+namespace Simulator {
+	// 同じ結合定数を持つR個のレプリカをN×R行列として保持し、同期更新の局所磁場を1回の行列積で計算する。
+	// SCA, fcSCA, MA, MMAのみに対応する。温度と乱数列はレプリカ毎に独立。
+	class ReplicaBatch {
+	public:
+		ReplicaBatch(const IsingModel& isingModel, const std::size_t numReplicas);
+		Eigen::VectorXd GetEnergies() const;
+		Eigen::VectorXd GetEnergiesOnBipartiteGraph() const;
+		void GiveSpins(const IsingModel::ConfigurationsType configurationType);
+		void SetSeed();
+		void SetSeed(const unsigned int seed);
+		void Update();
+
+		std::size_t GetNumReplicas() const
+		{
+			return static_cast<std::size_t>(spins.cols());
+		}
+
+		Algorithms GetCurrentAlgorithm() const
+		{
+			return algorithm;
+		}
+
+		void ChangeAlgorithmTo(const Algorithms algorithm)
+		{
+			this->algorithm = checkAlgorithm(algorithm);
+		}
+
+		Eigen::VectorXd GetTemperatures() const
+		{
+			return temperatures;
+		}
+
+		void SetTemperatures(const Eigen::VectorXd& temperatures)
+		{
+			this->temperatures = temperatures.cwiseMax(0.e0);
+		}
+
+		void SetTemperature(const double temperature)
+		{
+			temperatures.setConstant(std::max(temperature, 0.e0));
+		}
+
+		double GetPinningParameter() const
+		{
+			return pinningParameter;
+		}
+
+		void SetPinningParameter(const double pinningParameter)
+		{
+			this->pinningParameter = std::max(pinningParameter, 0.e0);
+		}
+
+		double GetFlipTrialRate() const
+		{
+			return flipTrialRate;
+		}
+
+		void SetFlipTrialRate(const double flipTrialRate)
+		{
+			this->flipTrialRate = std::min(std::max(flipTrialRate, 0.e0), 1.e0);
+		}
+
+		// 第r列がr番目のレプリカのスピン配位。
+		Eigen::MatrixXi GetSpins() const
+		{
+			return spins.cast<int>();
+		}
+	private:
+		std::vector<std::unique_ptr<Rand>> rands;
+		Eigen::VectorXd temperatures;
+		double pinningParameter;
+		double flipTrialRate;
+		Algorithms algorithm;
+		std::shared_ptr<const CouplingMatrix> couplingCoefficients;
+		Eigen::VectorXd externalMagneticField;
+		Eigen::MatrixXd spins;               // 成分は±1だが、行列積にそのまま渡せるようにdoubleで持つ。
+		Eigen::MatrixXd previousSpins;
+		Eigen::MatrixXd localMagneticFields;  // J S + h 1^T
+
+		static Algorithms checkAlgorithm(const Algorithms algorithm)
+		{
+			if (algorithm != Algorithms::SCA && algorithm != Algorithms::fcSCA && algorithm != Algorithms::MA && algorithm != Algorithms::MMA)
+				throw std::invalid_argument("ReplicaBatch: only SCA, fcSCA, MA and MMA are supported.");
+			return algorithm;
+		}
+
+		void recalculateLocalMagneticFields()
+		{
+			localMagneticFields = couplingCoefficients->Multiply(spins).colwise() + externalMagneticField;
+		}
+
+		// 各列をそのレプリカの乱数列で一括して埋める。transformは64ビットの乱数を値に変換する。
+		template<typename Transform>
+		Eigen::MatrixXd generateNoise(Transform transform)
+		{
+			Eigen::MatrixXd noise(spins.rows(), spins.cols());
+			for (auto r = 0; r < noise.cols(); r++)
+				rands[r]->Fill(noise.col(r).data(), noise.rows(), transform);
+			return noise;
+		}
+	};
+}
+
+#endif // !REPLICA_BATCH_H
@@ -1,13 +1,97 @@
 ﻿#include "simulator.h"
+#include "trajectory_writer.h"
 #include <Eigen/Eigenvalues>
+#include <array>
 #include <future>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <set>
+#include <stdexcept>
 
 using namespace Simulator;
 
+namespace {
+	// 整数型の場合、その型で表せない値は受け付けない。
+	template<typename Scalar>
+	Scalar toScalar(const double value)
+	{
+		if constexpr (std::is_integral_v<Scalar>) {
+			if (value != std::round(value) || value < std::numeric_limits<Scalar>::min() || value > std::numeric_limits<Scalar>::max())
+				throw std::invalid_argument("IsingModel: " + std::to_string(value) + " is not representable by the scalar type.");
+		}
+		return static_cast<Scalar>(value);
+	}
+
+	// 添字付きの二分ヒープ。キーが最小の添字を取り出し、任意の添字のキーを O(log N) で変更できる。
+	class IndexedMinHeap {
+	public:
+		explicit IndexedMinHeap(std::vector<double> keys)
+			: keys(std::move(keys))
+			, heap(this->keys.size())
+			, positions(this->keys.size())
+		{
+			for (std::size_t k = 0; k < heap.size(); k++)
+				heap[k] = positions[k] = k;
+			for (auto k = heap.size() / 2; k-- > 0;)
+				siftDown(k);
+		}
+
+		std::size_t Top() const
+		{
+			return heap.front();
+		}
+
+		double TopKey() const
+		{
+			return keys[heap.front()];
+		}
+
+		void Update(const std::size_t index, const double key)
+		{
+			auto previousKey = keys[index];
+			keys[index] = key;
+			if (key < previousKey)
+				siftUp(positions[index]);
+			else
+				siftDown(positions[index]);
+		}
+	private:
+		std::vector<double> keys;
+		std::vector<std::size_t> heap;       // heap[k] は k番目の節点の添字。
+		std::vector<std::size_t> positions;  // heap[positions[i]] == i.
+
+		void swapNodes(const std::size_t k, const std::size_t l)
+		{
+			std::swap(heap[k], heap[l]);
+			positions[heap[k]] = k;
+			positions[heap[l]] = l;
+		}
+
+		void siftUp(std::size_t k)
+		{
+			while (k > 0 && keys[heap[k]] < keys[heap[(k - 1) / 2]]) {
+				swapNodes(k, (k - 1) / 2);
+				k = (k - 1) / 2;
+			}
+		}
+
+		void siftDown(std::size_t k)
+		{
+			while (true) {
+				auto smallest = k;
+				for (const auto child : { 2 * k + 1, 2 * k + 2 })
+					if (child < heap.size() && keys[heap[child]] < keys[heap[smallest]])
+						smallest = child;
+				if (smallest == k)
+					return;
+				swapNodes(k, smallest);
+				k = smallest;
+			}
+		}
+	};
+}
+
 std::string Simulator::AlgorithmToStr(const Algorithms algorithm)
 {
 	switch (algorithm) {
@@ -31,12 +115,15 @@ std::string Simulator::AlgorithmToStr(const Algorithms algorithm)
 }
 
 // quadraticのキーのペア (i, j) は順番が i < j となっていなければならない。
-IsingModel::IsingModel(const LinearBiases linear, const QuadraticBiases quadratic)
+template<typename Scalar>
+BasicIsingModel<Scalar>::BasicIsingModel(const LinearBiases linear, const QuadraticBiases quadratic)
 	: rand(std::make_unique<Rand>())
 	, temperature(0.e0)
 	, pinningParameter(0.e0)
 	, flipTrialRate(0.e0)
 	, algorithm(Algorithms::Metropolis)
+	, hillClimbingStrategy(HillClimbingStrategies::Steepest)
+	, largestEigenvalueTolerance(0.e0)
 {
 	// spinsの添字と頂点の名前との対応表を作成。
 	std::set<Node> nodes;
@@ -52,51 +139,332 @@ IsingModel::IsingModel(const LinearBiases linear, const QuadraticBiases quadrati
 
 	// Hamiltonianの定数と変数を初期化。
 	auto maxNodes = nodeIndices.size();
-	spins.setConstant(maxNodes, Spin::Up);
-	previousSpins = spins;
 	externalMagneticField.resize(maxNodes);
 	for (const auto& node : nodeIndices) {
 		auto iter = linear.find(node.first);
 		if (iter != linear.end())
-			externalMagneticField(node.second) = iter->second;
+			externalMagneticField(node.second) = toScalar<Scalar>(iter->second);
 		else
-			externalMagneticField(node.second) = 0.e0;
+			externalMagneticField(node.second) = 0;
 	}
-	couplingCoefficients = Eigen::MatrixXd::Zero(maxNodes, maxNodes);
-	for (const auto& row : nodeIndices) {
-		for (const auto& column : nodeIndices) {
-			if (row.first > column.first)
-				continue;
-			auto iter = quadratic.find(std::make_pair(row.first, column.first));
-			if (iter != quadratic.end())
-				couplingCoefficients(row.second, column.second) = couplingCoefficients(column.second, row.second) = iter->second;
-			else
-				couplingCoefficients(row.second, column.second) = couplingCoefficients(column.second, row.second) = 0.e0;
+	std::vector<typename CouplingMatrixType::Triplet> upperTriangle;
+	upperTriangle.reserve(quadratic.size());
+	for (const auto& edge : quadratic) {
+		if (edge.first.first > edge.first.second || edge.second == 0.e0)
+			continue;
+		upperTriangle.push_back({ nodeIndices[edge.first.first], nodeIndices[edge.first.second], toScalar<Scalar>(edge.second) });
+	}
+	initialize(upperTriangle);
+}
+
+template<typename Scalar>
+BasicIsingModel<Scalar>::BasicIsingModel(const Eigen::VectorXd& linear, const std::vector<std::size_t>& rows, const std::vector<std::size_t>& columns,
+	const std::vector<double>& weights, const std::vector<Node>& labels)
+	: rand(std::make_unique<Rand>())
+	, temperature(0.e0)
+	, pinningParameter(0.e0)
+	, flipTrialRate(0.e0)
+	, algorithm(Algorithms::Metropolis)
+	, hillClimbingStrategy(HillClimbingStrategies::Steepest)
+	, largestEigenvalueTolerance(0.e0)
+{
+	auto size = static_cast<std::size_t>(linear.size());
+	if (rows.size() != weights.size() || columns.size() != weights.size())
+		throw std::invalid_argument("IsingModel: rows, columns and weights must have the same length.");
+	externalMagneticField.resize(size);
+	for (std::size_t i = 0; i < size; i++)
+		externalMagneticField(i) = toScalar<Scalar>(linear(i));
+	std::vector<typename CouplingMatrixType::Triplet> upperTriangle;
+	upperTriangle.reserve(weights.size());
+	for (std::size_t k = 0; k < weights.size(); k++) {
+		if (rows[k] >= size || columns[k] >= size)
+			throw std::invalid_argument("IsingModel: node index " + std::to_string(std::max(rows[k], columns[k])) + " is out of range.");
+		if (weights[k] != 0.e0)
+			upperTriangle.push_back({ std::min(rows[k], columns[k]), std::max(rows[k], columns[k]), toScalar<Scalar>(weights[k]) });
+	}
+	setNodeLabels(labels);
+	initialize(upperTriangle);
+}
+
+// 構築済みの結合定数を共有する（ファイルを写像した領域を指すものでもよい）。
+template<typename Scalar>
+BasicIsingModel<Scalar>::BasicIsingModel(const Eigen::VectorXd& linear, std::shared_ptr<const CouplingMatrixType> couplingCoefficients, const std::vector<Node>& labels)
+	: rand(std::make_unique<Rand>())
+	, temperature(0.e0)
+	, pinningParameter(0.e0)
+	, flipTrialRate(0.e0)
+	, algorithm(Algorithms::Metropolis)
+	, hillClimbingStrategy(HillClimbingStrategies::Steepest)
+	, largestEigenvalueTolerance(0.e0)
+{
+	if (static_cast<std::size_t>(linear.size()) != couplingCoefficients->Size())
+		throw std::invalid_argument("IsingModel: the sizes of the external magnetic field and the coupling coefficients differ.");
+	externalMagneticField.resize(linear.size());
+	for (auto i = 0; i < linear.size(); i++)
+		externalMagneticField(i) = toScalar<Scalar>(linear(i));
+	setNodeLabels(labels);
+	initialize(std::move(couplingCoefficients));
+}
+
+// externalMagneticFieldを設定した後に呼ぶ。全スピンを上向きにする。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::initialize(const std::vector<typename CouplingMatrixType::Triplet>& upperTriangle)
+{
+	initialize(std::make_shared<const CouplingMatrixType>(static_cast<std::size_t>(externalMagneticField.size()), upperTriangle));
+}
+
+template<typename Scalar>
+void BasicIsingModel<Scalar>::initialize(std::shared_ptr<const CouplingMatrixType> couplingCoefficients)
+{
+	spins.setConstant(externalMagneticField.size(), Spin::Up);
+	previousSpins = spins;
+	this->couplingCoefficients = std::move(couplingCoefficients);
+	colorNodes();
+	recalculateCaches();
+}
+
+// labelsが空ならば、添字をそのまま名前とする。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::setNodeLabels(const std::vector<Node>& labels)
+{
+	if (!labels.empty() && labels.size() != static_cast<std::size_t>(externalMagneticField.size()))
+		throw std::invalid_argument("IsingModel: the number of labels must equal the number of nodes.");
+	for (std::size_t i = 0; i < labels.size(); i++)
+		if (!nodeIndices.emplace(labels[i], i).second)
+			throw std::invalid_argument("IsingModel: labels must be unique.");
+}
+
+// 乱数列の状態も含めて複製する。結合定数は複製せずに共有する。スレッドプールは引き継がない。
+template<typename Scalar>
+BasicIsingModel<Scalar>::BasicIsingModel(const BasicIsingModel& other)
+	: rand(std::make_unique<Rand>(*other.rand))
+	, temperature(other.temperature)
+	, pinningParameter(other.pinningParameter)
+	, flipTrialRate(other.flipTrialRate)
+	, algorithm(other.algorithm)
+	, hillClimbingStrategy(other.hillClimbingStrategy)
+	, nodeIndices(other.nodeIndices)
+	, spins(other.spins)
+	, previousSpins(other.previousSpins)
+	, externalMagneticField(other.externalMagneticField)
+	, couplingCoefficients(other.couplingCoefficients)
+	, colorOffsets(other.colorOffsets)
+	, coloredNodes(other.coloredNodes)
+	, largestEigenvalue(other.largestEigenvalue)
+	, largestEigenvalueTolerance(other.largestEigenvalueTolerance)
+	, localMagneticField(other.localMagneticField)
+	, energy(other.energy)
+	, halfFieldDifference(other.halfFieldDifference)
+	, overlap(other.overlap)
+	, spinSum(other.spinSum)
+{
+}
+
+// upperTriangleには (i, j), i <= j の成分のみを与える。(j, i) 成分は対称性から補う。
+template<typename Scalar>
+BasicCouplingMatrix<Scalar>::BasicCouplingMatrix(const std::size_t size, const std::vector<Triplet>& upperTriangle)
+	: size(size)
+	, sparse(false)
+{
+	std::size_t nonZeros = 0;
+	for (const auto& entry : upperTriangle)
+		nonZeros += (entry.row == entry.column) ? 1 : 2;
+	sparse = size > 0 && nonZeros <= SparsityThreshold * size * size;
+
+	if (!sparse) {
+		denseStorage = DenseMatrix::Zero(size, size);
+		for (const auto& entry : upperTriangle) {
+			denseStorage(entry.row, entry.column) += entry.value;
+			if (entry.row != entry.column)
+				denseStorage(entry.column, entry.row) += entry.value;
+		}
+		setViews();
+		return;
+	}
+
+	// 各行の成分数を数えてから詰める。
+	rowOffsetsStorage.assign(size + 1, 0);
+	for (const auto& entry : upperTriangle) {
+		rowOffsetsStorage[entry.row + 1]++;
+		if (entry.row != entry.column)
+			rowOffsetsStorage[entry.column + 1]++;
+	}
+	for (std::size_t row = 0; row < size; row++)
+		rowOffsetsStorage[row + 1] += rowOffsetsStorage[row];
+	std::vector<std::int64_t> positions(rowOffsetsStorage.begin(), rowOffsetsStorage.end() - 1);
+	columnIndicesStorage.resize(nonZeros);
+	valuesStorage.resize(nonZeros);
+	for (const auto& entry : upperTriangle) {
+		columnIndicesStorage[positions[entry.row]] = static_cast<std::int32_t>(entry.column);
+		valuesStorage[positions[entry.row]++] = entry.value;
+		if (entry.row != entry.column) {
+			columnIndicesStorage[positions[entry.column]] = static_cast<std::int32_t>(entry.row);
+			valuesStorage[positions[entry.column]++] = entry.value;
+		}
+	}
+
+	// 各行を列番号順に並べ、重複する成分をまとめる。
+	std::vector<std::pair<std::int32_t, Scalar>> rowEntries;
+	std::int64_t last = 0;
+	for (std::size_t row = 0; row < size; row++) {
+		rowEntries.clear();
+		for (auto k = rowOffsetsStorage[row]; k < rowOffsetsStorage[row + 1]; k++)
+			rowEntries.emplace_back(columnIndicesStorage[k], valuesStorage[k]);
+		std::sort(rowEntries.begin(), rowEntries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+		rowOffsetsStorage[row] = last;
+		for (const auto& rowEntry : rowEntries) {
+			if (last > rowOffsetsStorage[row] && columnIndicesStorage[last - 1] == rowEntry.first) {
+				valuesStorage[last - 1] += rowEntry.second;
+			} else {
+				columnIndicesStorage[last] = rowEntry.first;
+				valuesStorage[last++] = rowEntry.second;
+			}
 		}
 	}
+	rowOffsetsStorage[size] = last;
+	columnIndicesStorage.resize(last);
+	valuesStorage.resize(last);
+	setViews();
+}
+
+template<typename Scalar>
+typename BasicCouplingMatrix<Scalar>::DenseMatrix BasicCouplingMatrix<Scalar>::ToDense() const
+{
+	if (!sparse)
+		return dense;
+	DenseMatrix result = DenseMatrix::Zero(size, size);
+	for (std::size_t row = 0; row < size; row++)
+		for (auto k = rowOffsets[row]; k < rowOffsets[row + 1]; k++)
+			result(row, columnIndices[k]) = values[k];
+	return result;
+}
+
+// 外部の領域をそのまま使う。denseは列優先の size * size 個の成分で、storageが生きている間は有効でなければならない。
+template<typename Scalar>
+BasicCouplingMatrix<Scalar>::BasicCouplingMatrix(const std::size_t size, const Scalar* dense, std::shared_ptr<const void> storage)
+	: size(size)
+	, sparse(false)
+	, externalStorage(std::move(storage))
+	, dense(dense, size, size)
+{
+}
+
+// 外部のCSR形式の配列をそのまま使う。各行の列番号は昇順で、対称な成分を両方含んでいなければならない。
+template<typename Scalar>
+BasicCouplingMatrix<Scalar>::BasicCouplingMatrix(const std::size_t size, const std::int64_t* rowOffsets, const std::int32_t* columnIndices, const Scalar* values,
+	std::shared_ptr<const void> storage)
+	: size(size)
+	, sparse(true)
+	, externalStorage(std::move(storage))
+	, rowOffsets(rowOffsets)
+	, columnIndices(columnIndices)
+	, values(values)
+	, numNonZeros(static_cast<std::size_t>(rowOffsets[size]))
+{
+}
+
+template<typename Scalar>
+void BasicCouplingMatrix<Scalar>::setViews()
+{
+	if (!sparse) {
+		new (&dense) Eigen::Map<const DenseMatrix>(denseStorage.data(), size, size);
+		return;
+	}
+	rowOffsets = rowOffsetsStorage.data();
+	columnIndices = columnIndicesStorage.data();
+	values = valuesStorage.data();
+	numNonZeros = valuesStorage.size();
 }
 
-// 行列 (-J_{x, y})_{x, y} の最大固有値を計算する。
-double IsingModel::CalcLargestEigenvalue() const
+// 行列 (-J_{x, y})_{x, y} の最大固有値を計算する。maxIterations回で許容誤差に達しなければ例外を投げる。
+template<typename Scalar>
+double BasicIsingModel<Scalar>::CalcLargestEigenvalue(const double tolerance, const std::size_t maxIterations) const
 {
-	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(-couplingCoefficients);
-	return solver.eigenvalues().reverse()(0);
+	if (largestEigenvalue && largestEigenvalueTolerance <= tolerance)
+		return largestEigenvalue.value();
+	auto size = static_cast<std::size_t>(spins.size());
+	if (size == 0)
+		return 0.e0;
+
+	// -J に対するLanczos法。再直交化はしないが、最大のRitz値の収束には影響しない。
+	// Ritz値の残差 |beta_{k+1} y_k| が許容誤差 * ‖J‖ 以下になるか、Krylov部分空間が不変になったら止める。
+	// ‖J‖ は絶対値が最大のRitz値で見積もる。|Ritz値| で割ると、最大固有値が0に近い行列で収束しなくなる。
+	constexpr std::size_t CheckInterval = 10;
+	constexpr std::size_t DenseFallbackSize = 1024;  // 収束しなければ、この大きさまでは密行列として対角化する。
+	Rand generator(0, 0);  // 結果が再現するように、開始ベクトルは固定のストリームから作る。
+	Eigen::VectorXd v(size), previousV = Eigen::VectorXd::Zero(size);
+	generator.FillUniform(v.data(), size);
+	v.array() -= 0.5e0;
+	v.normalize();
+	std::vector<double> alphas, betas;
+	double beta = 0.e0;
+	double result = 0.e0;
+	bool isConverged = false;
+	double reachedTolerance = 0.e0;  // 達した残差 / ‖J‖.
+	auto iterations = std::min(std::max<std::size_t>(maxIterations, 1), size);
+	for (std::size_t k = 0; k < iterations; k++) {
+		Eigen::VectorXd w = -couplingCoefficients->MultiplyInDouble(v);
+		double alpha = w.dot(v);
+		w -= alpha * v + beta * previousV;
+		alphas.push_back(alpha);
+		beta = w.norm();
+		bool isInvariant = beta <= std::numeric_limits<double>::epsilon() * std::abs(alpha);
+		if (isInvariant || (k + 1) % CheckInterval == 0 || k + 1 == iterations) {
+			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+			solver.computeFromTridiagonal(Eigen::Map<Eigen::VectorXd>(alphas.data(), alphas.size()), Eigen::Map<Eigen::VectorXd>(betas.data(), betas.size()));
+			result = solver.eigenvalues()(alphas.size() - 1);
+			double residual = beta * std::abs(solver.eigenvectors()(alphas.size() - 1, alphas.size() - 1));
+			double norm = std::max(std::abs(solver.eigenvalues()(0)), std::abs(result));
+			// -Ofastでは無限大との比較が当てにならないので、収束したかどうかは別に持つ。
+			if (isInvariant || residual == 0.e0) {
+				reachedTolerance = 0.e0;
+				isConverged = true;
+			} else if (norm > 0.e0) {
+				reachedTolerance = residual / norm;
+				isConverged = residual <= tolerance * norm;
+			}
+			if (isConverged)
+				break;
+		}
+		betas.push_back(beta);
+		previousV = v;
+		v = w / beta;
+	}
+	if (!isConverged && size <= DenseFallbackSize) {  // 小さい行列は直接対角化する。
+		Eigen::MatrixXd matrix = Eigen::MatrixXd::Zero(size, size);
+		for (std::size_t i = 0; i < size; i++)
+			couplingCoefficients->ForEachInRow(i, [&matrix, i](const std::size_t j, const Scalar value) {
+				matrix(i, j) = -static_cast<double>(value);
+			});
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(matrix, Eigen::EigenvaluesOnly);
+		result = solver.eigenvalues()(size - 1);
+		reachedTolerance = 0.e0;
+		isConverged = true;
+	}
+	if (!isConverged)
+		throw std::runtime_error("IsingModel: the largest eigenvalue did not converge within maxIterations (residual / norm "
+			+ std::to_string(reachedTolerance) + ").");
+	largestEigenvalue = result;
+	largestEigenvalueTolerance = reachedTolerance;
+	return result;
 }
 
-double IsingModel::GetEnergy() const
+// エネルギーはスピンの更新と同時に計算しておくので、ここでは値を返すだけで済む。
+template<typename Scalar>
+double BasicIsingModel<Scalar>::GetEnergy() const
 {
-	// Remove double-counting duplicates by multiplying the sum by 1/2.
-	return -spins.cast<double>().transpose() * (0.5e0 * couplingCoefficients * spins.cast<double>() + externalMagneticField);
+	return energy;
 }
 
-double IsingModel::GetEnergyOnBipartiteGraph() const
+// H(s) + h^T (s - s') / 2 + q (N - s^T s') / 2 = -s^T J s / 2 - h^T (s + s') / 2 + q (N - s^T s') / 2.
+template<typename Scalar>
+double BasicIsingModel<Scalar>::GetEnergyOnBipartiteGraph() const
 {
-	return -0.5e0 * spins.cast<double>().transpose() * couplingCoefficients * spins.cast<double>()
-		- 0.5e0 * externalMagneticField.dot(spins.cast<double>() + previousSpins.cast<double>())
-		+ 0.5e0 * pinningParameter * (spins.size() - spins.cast<double>().dot(previousSpins.cast<double>()));
+	return energy + halfFieldDifference + 0.5e0 * pinningParameter * (spins.size() - overlap);
 }
 
-void IsingModel::GiveSpins(const ConfigurationsType configurationType)
+template<typename Scalar>
+void BasicIsingModel<Scalar>::GiveSpins(const ConfigurationsType configurationType)
 {
 	switch (configurationType) {
 	case ConfigurationsType::AllDown:
@@ -113,125 +481,628 @@ void IsingModel::GiveSpins(const ConfigurationsType configurationType)
 		break;
 	}
 	previousSpins = spins;
+	recalculateCaches();
+}
+
+// 変化したスピンの列だけ局所磁場に足し込む。変化が多い場合はまとめて計算し直す方が速い。
+// 同時に H(s + d) - H(s) = -d^T (f(s) + f(s + d)) / 2 からエネルギーを更新する。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::recalculateCaches()
+{
+	SIMULATOR_COUNT(FieldRecalculations, 1);
+	SIMULATOR_TIME(FieldNanoseconds);
+	if (!threadPool) {
+		localMagneticField = couplingCoefficients->Multiply(spins.cast<double>()) + externalMagneticField;
+	} else {
+		FieldVector x = spins.template cast<Accumulator>();
+		localMagneticField.resize(spins.size());
+		forEachRowRange([this, &x](const std::size_t first, const std::size_t count) {
+			couplingCoefficients->MultiplyRows(x, localMagneticField, first, count);
+			localMagneticField.segment(first, count) += externalMagneticField.segment(first, count);
+		});
+	}
+	energy = -0.5e0 * sumOverRowRanges([this](const std::size_t first, const std::size_t count) {
+		return spins.segment(first, count).cast<double>().dot((localMagneticField.segment(first, count) + externalMagneticField.segment(first, count)).template cast<double>());
+	});
+	spinSum = sumOverRowRanges([this](const std::size_t first, const std::size_t count) {
+		return spins.segment(first, count).cast<double>().sum();
+	});
+	recalculateBipartiteTerms();
 }
 
-void IsingModel::Update()
+// 変化したスピンの数を返す。
+template<typename Scalar>
+std::size_t BasicIsingModel<Scalar>::updateSpins(const Configuration& nextSpins)
 {
-	auto metropolisMethod = [this]() {
-		unsigned int updatedNodeIndex = (*rand)(spins.size());
-		double energyDifference = 2.e0 * static_cast<int>(spins(updatedNodeIndex)) * calcLocalMagneticField(updatedNodeIndex);
+	std::vector<std::size_t> changedNodeIndices;
+	for (auto i = 0; i < spins.size(); i++)
+		if (nextSpins(i) != spins(i))
+			changedNodeIndices.push_back(i);
+	if (2 * changedNodeIndices.size() > static_cast<std::size_t>(spins.size())) {
+		spins = nextSpins;
+		recalculateCaches();
+		return changedNodeIndices.size();
+	}
+	std::vector<double> previousFields;
+	std::vector<int> differences;
+	previousFields.reserve(changedNodeIndices.size());
+	differences.reserve(changedNodeIndices.size());
+	for (const auto i : changedNodeIndices) {
+		previousFields.push_back(localMagneticField(i));
+		differences.push_back(static_cast<int>(nextSpins(i)) - static_cast<int>(spins(i)));
+	}
+	addToLocalField(changedNodeIndices, differences);
+	for (std::size_t k = 0; k < changedNodeIndices.size(); k++) {
+		auto i = changedNodeIndices[k];
+		energy -= 0.5e0 * differences[k] * (previousFields[k] + localMagneticField(i));
+		spinSum += differences[k];
+	}
+	spins = nextSpins;
+	recalculateBipartiteTerms();
+	return changedNodeIndices.size();
+}
+
+// 同期更新の1ステップ: 直前の配位を保存してから、次の配位に差分で更新する。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::advanceSynchronously(const Configuration& nextSpins)
+{
+	{
+		SIMULATOR_TIME(CopyNanoseconds);
+		previousSpins = spins;
+	}
+	[[maybe_unused]] auto numFlips = updateSpins(nextSpins);
+	SIMULATOR_COUNT(Proposals, spins.size());
+	SIMULATOR_COUNT(AcceptedFlips, numFlips);
+	SIMULATOR_COUNT(SynchronousSteps, 1);
+	SIMULATOR_COUNT(SynchronousFlips, numFlips);
+}
+
+// localMagneticField += sum_k differences[k] J_{., nodes[k]}.
+template<typename Scalar>
+void BasicIsingModel<Scalar>::addToLocalField(const std::vector<std::size_t>& nodes, const std::vector<int>& differences)
+{
+	SIMULATOR_COUNT(FieldColumnUpdates, nodes.size());
+	SIMULATOR_TIME(FieldNanoseconds);
+	if (!threadPool) {
+		for (std::size_t k = 0; k < nodes.size(); k++)
+			couplingCoefficients->AddColumnTo(localMagneticField, nodes[k], differences[k]);
+		return;
+	}
+	forEachRowRange([this, &nodes, &differences](const std::size_t first, const std::size_t count) {  // 各行への加算の順序は区切り方に依らない。
+		for (std::size_t k = 0; k < nodes.size(); k++)
+			couplingCoefficients->AddColumnTo(localMagneticField, nodes[k], differences[k], first, count);
+	});
+}
+
+// 次数の大きい頂点から順に、隣接する頂点に使われていない最小の色を割り当てる（Welsh-Powell）。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::colorNodes()
+{
+	auto size = static_cast<std::size_t>(spins.size());
+	std::vector<std::size_t> degrees(size, 0);
+	for (std::size_t i = 0; i < size; i++)
+		couplingCoefficients->ForEachInRow(i, [&degrees, i](const std::size_t j, const Scalar) {
+			if (j != i)
+				degrees[i]++;
+		});
+	std::vector<std::size_t> order(size);
+	for (std::size_t i = 0; i < size; i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&degrees](const std::size_t i, const std::size_t j) { return degrees[i] > degrees[j]; });
+
+	const auto uncolored = std::numeric_limits<std::size_t>::max();
+	std::vector<std::size_t> colors(size, uncolored);
+	std::vector<std::size_t> usedBy;  // usedBy[c] == i ならば、色cは頂点iの隣接頂点に使われている。
+	std::size_t numColors = 0;
+	for (const auto i : order) {
+		couplingCoefficients->ForEachInRow(i, [&colors, &usedBy, i, uncolored](const std::size_t j, const Scalar) {
+			if (j != i && colors[j] != uncolored)
+				usedBy[colors[j]] = i;
+		});
+		std::size_t color = 0;
+		while (color < numColors && usedBy[color] == i)
+			color++;
+		if (color == numColors) {
+			usedBy.push_back(uncolored);
+			numColors++;
+		}
+		colors[i] = color;
+	}
+
+	colorOffsets.assign(numColors + 1, 0);
+	for (std::size_t i = 0; i < size; i++)
+		colorOffsets[colors[i] + 1]++;
+	for (std::size_t c = 0; c < numColors; c++)
+		colorOffsets[c + 1] += colorOffsets[c];
+	coloredNodes.resize(size);
+	auto positions = colorOffsets;
+	for (std::size_t i = 0; i < size; i++)  // 同じ色の中では添字の昇順。
+		coloredNodes[positions[colors[i]]++] = i;
+}
+
+// MetropolisとGlauberの1スピン更新。エネルギー差は対角成分の寄与を含めてflipEnergyDifferenceで計算する。
+template<typename Scalar>
+template<Algorithms Kernel>
+void BasicIsingModel<Scalar>::updateSingleSpin()
+{
+	SIMULATOR_COUNT(Proposals, 1);
+	unsigned int updatedNodeIndex = (*rand)(spins.size());
+	if constexpr (Kernel == Algorithms::Metropolis) {
+		double energyDifference = flipEnergyDifference(updatedNodeIndex);
 		if (energyDifference < 0.e0)
-			spins(updatedNodeIndex) = flip(spins(updatedNodeIndex));
+			flipSpin(updatedNodeIndex);
 		else if (rand->Bernoulli(std::exp(-energyDifference / temperature)))
-			spins(updatedNodeIndex) = flip(spins(updatedNodeIndex));
-	};
+			flipSpin(updatedNodeIndex);
+	} else {
+		// E(s_i = +1) - E(s_i = -1) = -s_i ΔE.
+		double upEnergyDifference = -static_cast<int>(spins(updatedNodeIndex)) * flipEnergyDifference(updatedNodeIndex);
+		Spin nextSpin = rand->Bernoulli(1.e0 / (1.e0 + std::exp(upEnergyDifference / temperature))) ? Spin::Up : Spin::Down;
+		if (nextSpin != spins(updatedNodeIndex))
+			flipSpin(updatedNodeIndex);
+	}
+}
 
-	auto glauberDynamics = [this]() {
-		unsigned int updatedNodeIndex = (*rand)(spins.size());
-		if (rand->Bernoulli(1.e0 / (1.e0 + std::exp(-2.e0 * calcLocalMagneticField(updatedNodeIndex) / temperature))))
-			spins(updatedNodeIndex) = Spin::Up;
+// SCA, fcSCA, MA, MMAの同期更新。次のスピンは sign(J s + h + q s - T z s'') で、違いは雑音zの分布とスピンs''だけ。
+//   SCA, fcSCA: z ~ Logistic, s'' = 1 (fcSCAでは、確率 1 - flipTrialRate で +inf s を加えて反転を禁じる)。
+//   MA: z ~ Exp(1), s'' = 直前の配位。 MMA: z ~ Exp(1), s'' = s.
+// 雑音は1要素ずつではなく、ベクトル全体をまとめて生成する。
+// 乱数列の区間を先に確保し、各行の区間では対応する部分だけを生成するので、区切り方に依らず同じ雑音になる。
+template<typename Scalar>
+template<Algorithms Kernel>
+void BasicIsingModel<Scalar>::updateSynchronously()
+{
+	constexpr bool isLogistic = Kernel == Algorithms::SCA || Kernel == Algorithms::fcSCA;
+	constexpr bool isFlipConstrained = Kernel == Algorithms::fcSCA;
+	auto size = static_cast<std::size_t>(spins.size());
+	auto noiseBlock = rand->Reserve(size);
+	Rand::Block constraintBlock{};
+	if constexpr (isFlipConstrained)
+		constraintBlock = rand->Reserve(size);
+	Eigen::VectorXd noise(size), constraints;
+	if constexpr (isFlipConstrained)
+		constraints.resize(size);
+	Configuration nextSpins(size);
+	forEachRowRange([this, &noiseBlock, &constraintBlock, &noise, &constraints, &nextSpins](const std::size_t first, const std::size_t count) {
+		{
+			SIMULATOR_TIME(RandomNanoseconds);
+			if constexpr (isLogistic)
+				rand->Fill(noiseBlock, noise.data(), first, first + count, [](const std::uint64_t word) { return Rand::ToLogistic(word); });
+			else
+				rand->Fill(noiseBlock, noise.data(), first, first + count, [](const std::uint64_t word) { return Rand::ToExponential(word); });
+			if constexpr (isFlipConstrained)
+				rand->Fill(constraintBlock, constraints.data(), first, first + count, [this](const std::uint64_t word) -> double {
+					return (Rand::ToUniform(word) < flipTrialRate) ? 0.e0 : std::numeric_limits<double>::infinity();
+				});
+		}
+		SIMULATOR_TIME(AcceptanceNanoseconds);
+		auto noiseSegment = noise.segment(first, count);
+		if constexpr (Kernel == Algorithms::MA)  // +-1を掛けるだけなので丸め誤差は生じない。
+			noiseSegment = noiseSegment.cwiseProduct(previousSpins.segment(first, count).template cast<double>());
+		else if constexpr (Kernel == Algorithms::MMA)
+			noiseSegment = noiseSegment.cwiseProduct(spins.segment(first, count).template cast<double>());
+		auto spinSegment = spins.segment(first, count).template cast<double>();
+		auto field = localMagneticField.segment(first, count).template cast<double>() + pinningParameter * spinSegment - temperature * noiseSegment;
+		// 実質起こらないが、符号関数に渡しているため、スピンが0になる場合がある。
+		if constexpr (isFlipConstrained)
+			nextSpins.segment(first, count) = (field + constraints.segment(first, count).cwiseProduct(spinSegment)).array().sign().template cast<Spin>();
 		else
-			spins(updatedNodeIndex) = Spin::Down;
-	};
+			nextSpins.segment(first, count) = field.array().sign().template cast<Spin>();
+	});
+	advanceSynchronously(nextSpins);
+}
 
-	auto stochasticCellularAutomata = [this]() {
-		previousSpins = spins;
-		spins = (
-			calcLocalMagneticField(spins) + pinningParameter * spins.cast<double>()
-			- temperature * Eigen::VectorXd::NullaryExpr(spins.size(), [this]() -> double { return rand->Logistic(); })
-		).array().sign().cast<Spin>();  // 実質起こらないが、符号関数に渡しているため、スピンが0になる場合がある。
-	};
+// アルゴリズムをテンプレート引数で固定した1回分の更新。Runでは実行の最初に1度だけ選ぶので、ステップ毎の分岐がなくなる。
+template<typename Scalar>
+template<Algorithms Kernel>
+void BasicIsingModel<Scalar>::update()
+{
+	if constexpr (Kernel == Algorithms::Metropolis || Kernel == Algorithms::Glauber)
+		updateSingleSpin<Kernel>();
+	else if constexpr (Kernel == Algorithms::HillClimbing)
+		climbHill();
+	else
+		updateSynchronously<Kernel>();
+}
 
-	auto flipConstrainedStochasticCellularAutomata = [this]() {
-		previousSpins = spins;
-		//auto bernoulli =  Eigen::VectorXd::NullaryExpr(spins.size(), [this]() -> bool { return rand->Bernoulli(flipTrialRate) ; });  // = true w.p. flipTrialRate and = false w.p. 1 - flipTrialRate.
-		spins = (
-			calcLocalMagneticField(spins) + pinningParameter * spins.cast<double>()
-			- temperature * Eigen::VectorXd::NullaryExpr(spins.size(), [this]() -> double { return rand->Logistic(); })
-			+ Eigen::VectorXd::NullaryExpr(spins.size(), [this]() -> double {
-				return rand->Bernoulli(flipTrialRate) ? 0.e0 : std::numeric_limits<double>::infinity();
-			}).cwiseProduct(spins.cast<double>())
-			//+ bernoulli.unaryExpr([](bool b) -> double { return b ? 0.e0 : std::numeric_limits<double>::infinity(); }).cwiseProduct(spins.cast<double>())
-		).array().sign().cast<Spin>();  // 実質起こらないが、符号関数に渡しているため、スピンが0になる場合がある。
-	};
+// 温度を下げなければ ``annealing'' ではないが、論文では区別していないので、MA, MMAの名称を用いる。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::Update()
+{
+	dispatch([this](auto kernel) {
+		this->template update<decltype(kernel)::value>();
+	});
+}
 
-	// 温度を下げなければ ``annealing'' ではないが、論文では区別していないので、ここでもこの名称を用いる。
-	auto momentumAnnealing = [this]() {
-		Configuration temp = (
-			calcLocalMagneticField(spins) + pinningParameter * spins.cast<double>()
-			- temperature * Eigen::VectorXd::NullaryExpr(spins.size(), [this]() -> double { return rand->Exponential(); }).cwiseProduct(previousSpins.cast<double>())
-		).array().sign().cast<Spin>();  // 実質起こらないが、符号関数に渡しているため、スピンが0になる場合がある。
-		previousSpins = spins;
-		spins = temp;
-	};
+// 局所磁場を差分で保っているので、スピンを1つ反転する毎に、それと結合するスピンのエネルギー差だけを更新すればよい。
+// Steepestでは各スピンのエネルギー差をヒープに入れ、最も小さいものを取り出す。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::climbHill()
+{
+	auto size = static_cast<std::size_t>(spins.size());
+	auto threshold = improvementThreshold();
+	if (hillClimbingStrategy == HillClimbingStrategies::Steepest) {
+		std::vector<double> energyDifferences(size);
+		for (std::size_t i = 0; i < size; i++)
+			energyDifferences[i] = flipEnergyDifference(i);
+		IndexedMinHeap heap(std::move(energyDifferences));
+		while (size > 0 && heap.TopKey() < threshold) {
+			auto i = heap.Top();
+			flipSpin(i);
+			heap.Update(i, flipEnergyDifference(i));
+			couplingCoefficients->ForEachInRow(i, [this, &heap, i](const std::size_t j, const Scalar) {
+				if (j != i)
+					heap.Update(j, flipEnergyDifference(j));
+			});
+		}
+		return;
+	}
 
-	auto modifiedMomentumAnnealing = [this]() {
-		previousSpins = spins;
-		spins = (
-			calcLocalMagneticField(spins) + pinningParameter * spins.cast<double>()
-			- temperature * Eigen::VectorXd::NullaryExpr(spins.size(), [this]() -> double { return rand->Exponential(); }).cwiseProduct(spins.cast<double>())
-		).array().sign().cast<Spin>();  // 実質起こらないが、符号関数に渡しているため、スピンが0になる場合がある。
-	};
+	std::vector<std::size_t> order(size);
+	for (std::size_t i = 0; i < size; i++)
+		order[i] = i;
+	for (bool isImproved = true; isImproved;) {
+		isImproved = false;
+		if (hillClimbingStrategy == HillClimbingStrategies::Randomized)
+			std::shuffle(order.begin(), order.end(), *rand);
+		for (const auto i : order) {
+			if (flipEnergyDifference(i) < threshold) {
+				flipSpin(i);
+				isImproved = true;
+			}
+		}
+	}
+}
+
+// 山登り法で改善とみなすエネルギー差の上限。浮動小数点の結合定数では、丸め誤差で反転とその逆がどちらも負に見えて
+// 循環しないように、局所磁場の大きさの上限 max_i (sum_j |J_{ij}| + |h_i|) に比例する余裕を取る。整数ならば0.
+template<typename Scalar>
+double BasicIsingModel<Scalar>::improvementThreshold() const
+{
+	constexpr double Epsilon = std::numeric_limits<Accumulator>::epsilon();
+	if constexpr (Epsilon == 0.e0) {
+		return 0.e0;
+	} else {
+		double maxFieldBound = 0.e0;
+		for (std::size_t i = 0; i < static_cast<std::size_t>(spins.size()); i++) {
+			double bound = std::abs(static_cast<double>(externalMagneticField(i)));
+			couplingCoefficients->ForEachInRow(i, [&bound](const std::size_t, const Scalar value) {
+				bound += std::abs(static_cast<double>(value));
+			});
+			maxFieldBound = std::max(maxFieldBound, bound);
+		}
+		return -64.e0 * Epsilon * maxFieldBound;
+	}
+}
 
-	auto hillClimbing = [this]() {
-		Configuration currentConfiguration = spins;
-		while (true) {
-			//double nextEval = std::numeric_limits<double>::infinity();
-			double energyDifference = 0.e0;
-			Configuration nextConfiguration = currentConfiguration;
-			for (auto i = 0; i < spins.size(); i++) {
-				double beforeEnergy = -1.e0 * static_cast<int>(currentConfiguration(i)) * calcLocalMagneticField(i);
-				double afterEnergy = -1.e0 * static_cast<int>(flip(currentConfiguration(i))) * calcLocalMagneticField(i);
-				if (energyDifference > afterEnergy - beforeEnergy) {
-					energyDifference = afterEnergy - beforeEnergy;
-					nextConfiguration(i) = flip(nextConfiguration(i));
-				}
+// MetropolisとGlauberで、色毎に同じ色の頂点を同時に更新する。同じ色の頂点は互いに結合していないので、
+// 各頂点の採択確率は他の頂点の更新に依らず、1スピン更新を色の順に行うのと同じ分布になる。各段は詳細釣り合いを満たすが、
+// 色の順に固定して繰り返すスイープ全体が保つのは（詳細釣り合いではなく）釣り合い条件で、Boltzmann分布はやはり定常分布になる。
+// 乱数列の区間を色毎に先に確保するので、スレッド数に依らず同じ結果になる。他のアルゴリズムではUpdateと同じ。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::Sweep()
+{
+	if (algorithm != Algorithms::Metropolis && algorithm != Algorithms::Glauber) {
+		Update();
+		return;
+	}
+	Eigen::VectorXd uniforms;
+	std::vector<char> isAccepted;
+	std::vector<std::size_t> flippedNodes;
+	std::vector<int> differences;
+	std::vector<double> previousFields;
+	for (std::size_t color = 0; color < GetNumColors(); color++) {
+		const std::size_t* nodes = coloredNodes.data() + colorOffsets[color];
+		auto size = colorOffsets[color + 1] - colorOffsets[color];
+		auto block = rand->Reserve(size);
+		uniforms.resize(size);
+		isAccepted.assign(size, 0);
+		SIMULATOR_COUNT(Proposals, size);
+		forEachRange(size, [this, &block, &uniforms, &isAccepted, nodes](const std::size_t first, const std::size_t count) {
+			Eigen::ArrayXd energyDifferences(count), probabilities(count);
+			{
+				SIMULATOR_TIME(RandomNanoseconds);
+				rand->Fill(block, uniforms.data(), first, first + count, [](const std::uint64_t word) { return Rand::ToUniform(word); });
 			}
-			if (energyDifference >= 0.e0)
-				break;
-			currentConfiguration = nextConfiguration;
+			SIMULATOR_TIME(AcceptanceNanoseconds);
+			for (std::size_t k = 0; k < count; k++) {
+				auto i = nodes[first + k];
+				energyDifferences(k) = flipEnergyDifference(i);
+			}
+			if (algorithm == Algorithms::Metropolis)  // 一様乱数は1未満なので、min(1, .) は不要。
+				probabilities = (-energyDifferences / temperature).exp();
+			else
+				probabilities = 1.e0 / (1.e0 + (energyDifferences / temperature).exp());
+			for (std::size_t k = 0; k < count; k++)
+				isAccepted[first + k] = (energyDifferences(k) < 0.e0 && algorithm == Algorithms::Metropolis) || uniforms(first + k) < probabilities(k);
+		});
+
+		flippedNodes.clear();
+		differences.clear();
+		previousFields.clear();
+		for (std::size_t k = 0; k < size; k++) {
+			if (!isAccepted[k])
+				continue;
+			flippedNodes.push_back(nodes[k]);
+			differences.push_back(-2 * static_cast<int>(spins(nodes[k])));
+			previousFields.push_back(localMagneticField(nodes[k]));
 		}
-		spins = currentConfiguration;
-	};
+		SIMULATOR_COUNT(AcceptedFlips, flippedNodes.size());
+		addToLocalField(flippedNodes, differences);
+		for (std::size_t k = 0; k < flippedNodes.size(); k++) {
+			auto i = flippedNodes[k];
+			spins(i) = flip(spins(i));
+			energy -= 0.5e0 * differences[k] * (previousFields[k] + localMagneticField(i));
+			halfFieldDifference += 0.5e0 * differences[k] * externalMagneticField(i);
+			overlap += differences[k] * static_cast<int>(previousSpins(i));
+			spinSum += differences[k];
+		}
+	}
+}
 
-	switch (algorithm) {
-	case Algorithms::Metropolis:
-		metropolisMethod();
-		break;
-	case Algorithms::Glauber:
-		glauberDynamics();
-		break;
-	case Algorithms::SCA:
-		stochasticCellularAutomata();
-		break;
-	case Algorithms::fcSCA:
-		flipConstrainedStochasticCellularAutomata();
-		break;
-	case Algorithms::MA:
-		momentumAnnealing();
-		break;
-	case Algorithms::MMA:
-		modifiedMomentumAnnealing();
-		break;
-	case Algorithms::HillClimbing:
-		hillClimbing();
-		break;
+// pointsはステップ数について昇順に並んでいなければならない。
+Schedule Schedule::Piecewise(const std::vector<std::pair<std::size_t, double>>& points)
+{
+	Schedule schedule(Types::Piecewise, 0.e0, 0.e0, 0.e0, points.size());
+	for (const auto& point : points) {
+		schedule.points.push_back(point.first);
+		schedule.values.push_back(point.second);
+	}
+	return schedule;
+}
+
+Schedule Schedule::Tabulated(const std::vector<double>& values)
+{
+	Schedule schedule(Types::Tabulated, 0.e0, 0.e0, 0.e0, values.size());
+	schedule.values = values;
+	return schedule;
+}
+
+double Schedule::operator()(const std::size_t step) const
+{
+	double n = static_cast<double>(step);
+	switch (type) {
+	case Types::Constant:
+		return initialValue;
+	case Types::Logarithmic:
+		return initialValue / (coefficient * std::log(n + 1.e0) + 1.e0);
+	case Types::LinearMultiplicative:
+		return initialValue / (coefficient * n + 1.e0);
+	case Types::QuadraticMultiplicative:
+		return initialValue / (coefficient * n * n + 1.e0);
+	case Types::LinearAdditive:
+		return (step >= steps) ? finalValue : initialValue + (finalValue - initialValue) * n / steps;
+	case Types::Exponential:
+		return initialValue * std::pow(coefficient, n);
+	case Types::Piecewise: {
+		if (values.empty())
+			return 0.e0;
+		auto upper = std::upper_bound(points.begin(), points.end(), step);
+		if (upper == points.begin())
+			return values.front();
+		if (upper == points.end())
+			return values.back();
+		auto k = static_cast<std::size_t>(upper - points.begin());
+		return values[k - 1] + (values[k] - values[k - 1]) * (n - points[k - 1]) / (points[k] - points[k - 1]);
+	}
+	case Types::Tabulated:
+		if (values.empty())
+			return 0.e0;
+		return values[std::min(step, values.size() - 1)];
 	default:
-		break;
+		return 0.e0;
 	}
 }
 
-void IsingModel::Write() const
+// Updateをsteps回（Sweepの場合はスイープ単位で）繰り返し、指定された物理量をステップ毎に記録する。
+template<typename Scalar>
+Trajectory BasicIsingModel<Scalar>::Run(const std::size_t steps, const RunOptions& options)
+{
+	Trajectory trajectory;
+	std::array<bool, static_cast<std::size_t>(Observables::SIZE)> isRecorded{};
+	for (const auto observable : options.observables)
+		isRecorded[static_cast<std::size_t>(observable)] = true;
+	if (isRecorded[static_cast<std::size_t>(Observables::Energy)])
+		trajectory.energies.resize(steps);
+	if (isRecorded[static_cast<std::size_t>(Observables::EnergyOnBipartiteGraph)])
+		trajectory.energiesOnBipartiteGraph.resize(steps);
+	if (isRecorded[static_cast<std::size_t>(Observables::Temperature)])
+		trajectory.temperatures.resize(steps);
+	if (isRecorded[static_cast<std::size_t>(Observables::Magnetization)])
+		trajectory.magnetizations.resize(steps);
+	if (options.snapshotInterval > 0)
+		trajectory.spinSnapshots.resize(steps / options.snapshotInterval, spins.size());
+
+	auto completedSteps = steps;
+	dispatch([this, steps, &options, &trajectory, &completedSteps](auto kernel) {
+		completedSteps = this->template runSteps<decltype(kernel)::value>(steps, options, trajectory);
+	});
+	if (completedSteps < steps) {  // stepCallbackで止めた。
+		for (auto values : { &trajectory.energies, &trajectory.energiesOnBipartiteGraph, &trajectory.temperatures, &trajectory.magnetizations })
+			if (values->size() > 0)
+				values->conservativeResize(completedSteps);
+		if (options.snapshotInterval > 0)
+			trajectory.spinSnapshots.conservativeResize(completedSteps / options.snapshotInterval, spins.size());
+	}
+	return trajectory;
+}
+
+// Runの本体。アルゴリズムを固定しているので、1ステップ内の更新（Sweep単位ではN回）は分岐なしに展開される。終えたステップ数を返す。
+template<typename Scalar>
+template<Algorithms Kernel>
+std::size_t BasicIsingModel<Scalar>::runSteps(const std::size_t steps, const RunOptions& options, Trajectory& trajectory)
+{
+	constexpr bool isSingleSpin = Kernel == Algorithms::Metropolis || Kernel == Algorithms::Glauber;
+	std::size_t updatesPerStep = 1;
+	if (options.stepUnit == StepUnits::Sweep && isSingleSpin)
+		updatesPerStep = spins.size();
+	for (std::size_t n = 0; n < steps; n++) {
+		if (options.temperatureSchedule)
+			SetTemperature((*options.temperatureSchedule)(options.firstStep + n));
+		if (options.pinningParameterSchedule)
+			SetPinningParameter((*options.pinningParameterSchedule)(options.firstStep + n));
+		if (options.flipTrialRateSchedule)
+			SetFlipTrialRate((*options.flipTrialRateSchedule)(options.firstStep + n));
+		if (options.stepUnit == StepUnits::ColoredSweep && isSingleSpin)
+			Sweep();
+		else
+			for (std::size_t k = 0; k < updatesPerStep; k++)
+				update<Kernel>();
+		if (trajectory.energies.size() > 0)
+			trajectory.energies(n) = GetEnergy();
+		if (trajectory.energiesOnBipartiteGraph.size() > 0)
+			trajectory.energiesOnBipartiteGraph(n) = GetEnergyOnBipartiteGraph();
+		if (trajectory.temperatures.size() > 0)
+			trajectory.temperatures(n) = temperature;
+		if (trajectory.magnetizations.size() > 0)
+			trajectory.magnetizations(n) = GetMagnetization();
+		if (options.trajectoryWriter)
+			options.trajectoryWriter->Push({ options.firstStep + n, GetEnergy(), GetEnergyOnBipartiteGraph(), temperature, GetMagnetization() });
+		if (options.snapshotInterval > 0 && (n + 1) % options.snapshotInterval == 0)
+			trajectory.spinSnapshots.row(n / options.snapshotInterval) = spins.cast<int>().cast<std::int8_t>().transpose();
+		if (options.stepCallback && !options.stepCallback(n + 1))
+			return n + 1;
+	}
+	return steps;
+}
+
+namespace {
+	constexpr char CheckpointMagic[8] = { 'I', 'S', 'I', 'N', 'G', 'C', 'K', 'P' };
+	constexpr std::uint32_t CheckpointVersion = 1;
+
+	// 書き出した環境と同じバイト順、同じ型の環境で読む。
+	struct CheckpointHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t scalarSize;
+		std::uint32_t accumulatorSize;
+		std::uint32_t isIntegral;
+		std::uint64_t numNodes;
+		std::uint64_t numNonZeros;
+	};
+
+	template<typename T>
+	void writeRaw(std::ostream& stream, const T* data, const std::size_t count)
+	{
+		stream.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(sizeof(T) * count));
+	}
+
+	template<typename T>
+	void readRaw(std::istream& stream, T* data, const std::size_t count)
+	{
+		if (!stream.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(sizeof(T) * count)))
+			throw std::runtime_error("IsingModel: truncated checkpoint.");
+	}
+}
+
+// 差分更新する量も計算し直さずにそのまま保存する。計算し直すと丸め誤差の分だけ続きの結果がずれうる。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::SaveCheckpoint(std::ostream& stream) const
+{
+	CheckpointHeader header{};
+	std::copy(std::begin(CheckpointMagic), std::end(CheckpointMagic), header.magic);
+	header.version = CheckpointVersion;
+	header.scalarSize = sizeof(Scalar);
+	header.accumulatorSize = sizeof(Accumulator);
+	header.isIntegral = std::is_integral_v<Scalar>;
+	header.numNodes = static_cast<std::uint64_t>(spins.size());
+	header.numNonZeros = static_cast<std::uint64_t>(couplingCoefficients->NonZeros());
+	writeRaw(stream, &header, 1);
+
+	const double parameters[] = { temperature, pinningParameter, flipTrialRate };
+	writeRaw(stream, parameters, 3);
+	const std::int32_t settings[] = { static_cast<std::int32_t>(algorithm), static_cast<std::int32_t>(hillClimbingStrategy) };
+	writeRaw(stream, settings, 2);
+	auto randState = rand->GetState();
+	writeRaw(stream, &randState, 1);
+
+	std::vector<std::int8_t> packed(spins.size());
+	for (auto i = 0; i < spins.size(); i++)
+		packed[i] = static_cast<std::int8_t>(spins(i));
+	writeRaw(stream, packed.data(), packed.size());
+	for (auto i = 0; i < previousSpins.size(); i++)
+		packed[i] = static_cast<std::int8_t>(previousSpins(i));
+	writeRaw(stream, packed.data(), packed.size());
+
+	writeRaw(stream, localMagneticField.data(), static_cast<std::size_t>(localMagneticField.size()));
+	const double terms[] = { energy, halfFieldDifference, overlap, spinSum };
+	writeRaw(stream, terms, 4);
+	if (!stream)
+		throw std::runtime_error("IsingModel: failed to write a checkpoint.");
+}
+
+// 全部読み終えてから書き換えるので、途中で例外を投げた場合は元の状態のまま。
+template<typename Scalar>
+void BasicIsingModel<Scalar>::LoadCheckpoint(std::istream& stream)
+{
+	CheckpointHeader header;
+	readRaw(stream, &header, 1);
+	if (!std::equal(std::begin(CheckpointMagic), std::end(CheckpointMagic), header.magic) || header.version != CheckpointVersion)
+		throw std::runtime_error("IsingModel: not a checkpoint.");
+	if (header.scalarSize != sizeof(Scalar) || header.accumulatorSize != sizeof(Accumulator) || header.isIntegral != std::is_integral_v<Scalar>)
+		throw std::invalid_argument("IsingModel: the checkpoint was saved with a different scalar type.");
+	if (header.numNodes != static_cast<std::uint64_t>(spins.size()) || header.numNonZeros != static_cast<std::uint64_t>(couplingCoefficients->NonZeros()))
+		throw std::invalid_argument("IsingModel: the checkpoint was saved from a different model.");
+
+	double parameters[3];
+	readRaw(stream, parameters, 3);
+	std::int32_t settings[2];
+	readRaw(stream, settings, 2);
+	if (settings[0] < 0 || settings[0] >= static_cast<std::int32_t>(Algorithms::SIZE)
+		|| settings[1] < 0 || settings[1] > static_cast<std::int32_t>(HillClimbingStrategies::Randomized))
+		throw std::runtime_error("IsingModel: invalid checkpoint.");
+	Rand::State randState;
+	readRaw(stream, &randState, 1);
+
+	std::vector<std::int8_t> packed(2 * spins.size());
+	readRaw(stream, packed.data(), packed.size());
+	for (const auto spin : packed)
+		if (spin != -1 && spin != +1)
+			throw std::runtime_error("IsingModel: invalid checkpoint.");
+	FieldVector nextLocalMagneticField(spins.size());
+	readRaw(stream, nextLocalMagneticField.data(), static_cast<std::size_t>(nextLocalMagneticField.size()));
+	double terms[4];
+	readRaw(stream, terms, 4);
+
+	auto nextRand = std::make_unique<Rand>(0, 0);
+	nextRand->SetState(randState);
+	rand = std::move(nextRand);
+	temperature = parameters[0];
+	pinningParameter = parameters[1];
+	flipTrialRate = parameters[2];
+	algorithm = static_cast<Algorithms>(settings[0]);
+	hillClimbingStrategy = static_cast<HillClimbingStrategies>(settings[1]);
+	for (auto i = 0; i < spins.size(); i++) {
+		spins(i) = static_cast<Spin>(packed[i]);
+		previousSpins(i) = static_cast<Spin>(packed[spins.size() + i]);
+	}
+	localMagneticField = std::move(nextLocalMagneticField);
+	energy = terms[0];
+	halfFieldDifference = terms[1];
+	overlap = terms[2];
+	spinSum = terms[3];
+}
+
+template<typename Scalar>
+void BasicIsingModel<Scalar>::Write() const
 {
 	std::cout << "Current spin configuration:" << std::endl;
 	for (auto i = 0; i < spins.size(); i++)
 		std::cout << std::setw(2) << static_cast<int>(spins(i));
 	std::cout << "External magnetic field:" << std::endl;
-	std::cout << externalMagneticField.transpose() << std::endl;
+	std::cout << GetExternalMagneticField().transpose() << std::endl;
 	std::cout << "Coupling coefficinets:" << std::endl;
-	std::cout << couplingCoefficients << std::endl;
+	std::cout << GetCouplingCoefficients() << std::endl;
 	std::cout << "Algorithm: " << AlgorithmToStr(algorithm) << std::endl;
 	std::cout << "Temperature: " << temperature << std::endl;
 	std::cout << "Pinning parameter: " << pinningParameter << std::endl;
 	std::cout << "Flip trial rate: " << flipTrialRate << std::endl;
 }
+
+template class Simulator::BasicCouplingMatrix<double>;
+template class Simulator::BasicCouplingMatrix<float>;
+template class Simulator::BasicCouplingMatrix<std::int16_t>;
+template class Simulator::BasicCouplingMatrix<std::int8_t>;
+template class Simulator::BasicIsingModel<double>;
+template class Simulator::BasicIsingModel<float>;
+template class Simulator::BasicIsingModel<std::int16_t>;
+template class Simulator::BasicIsingModel<std::int8_t>;
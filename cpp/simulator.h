@@ -1,81 +1,151 @@
 ﻿#ifndef SIMULATOR_H
 #define SIMULATOR_H
 
+#include "thread_pool.h"
 #include <Eigen/Core>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
 #include <map>
 #include <memory>
+#include <optional>
 #include <random>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
 
 // Ref: https://qiita.com/Gaccho/items/dc312fb5a056505f0a9f
+// Ref: J. K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3," SC '11.
+// 計数器に基づく乱数生成器Philox4x32-10。n番目の値はシード、ストリーム番号とnだけから決まるので、
+// 一括生成した区間をスレッドで分けて埋めても、結果はスレッド数に依らない。
 class Rand {
 public:
+	using result_type = std::uint64_t;
+
+	// Reserveで確保した乱数列の区間。
+	struct Block {
+		std::uint64_t counter;  // 先頭のPhiloxのブロック番号。
+		std::size_t size;
+	};
+
 	Rand()
 	{
-		mt.seed(rd());
+		Seed();
+	}
+
+	Rand(const std::uint64_t seed, const std::uint64_t stream)
+	{
+		Seed(seed, stream);
 	}
 
 	void Seed()
 	{
-		mt.seed(rd());
+		std::random_device rd;
+		Seed((static_cast<std::uint64_t>(rd()) << 32) | rd(), 0);
 	}
 
 	void Seed(const std::int_fast64_t seed)
 	{
-		mt.seed(seed);
+		Seed(static_cast<std::uint64_t>(seed), 0);
+	}
+
+	// シードが同じでもストリーム番号が異なれば独立な乱数列になる。
+	void Seed(const std::uint64_t seed, const std::uint64_t stream)
+	{
+		key = { static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32) };
+		this->stream = stream;
+		counter = 0;
+		bufferIndex = WordsPerBlock;
+	}
+
+	// 生成器の内部状態。SetStateで戻せば、GetStateを呼んだ時点の続きから同じ乱数列が得られる。
+	struct State {
+		std::uint64_t seed;
+		std::uint64_t stream;
+		std::uint64_t counter;
+		std::array<std::uint64_t, 2> buffer;  // 使いかけのブロック。
+		std::uint64_t bufferIndex;
+	};
+
+	State GetState() const
+	{
+		return { key[0] | (static_cast<std::uint64_t>(key[1]) << 32), stream, counter, buffer, bufferIndex };
+	}
+
+	void SetState(const State& state)
+	{
+		if (state.bufferIndex > WordsPerBlock)
+			throw std::invalid_argument("Rand: invalid state.");
+		Seed(state.seed, state.stream);
+		counter = state.counter;
+		buffer = state.buffer;
+		bufferIndex = static_cast<std::size_t>(state.bufferIndex);
+	}
+
+	static constexpr result_type min()
+	{
+		return 0;
+	}
+
+	static constexpr result_type max()
+	{
+		return ~result_type(0);
 	}
 
 	std::uint_fast64_t operator()()
 	{
-		return mt();
+		if (bufferIndex == WordsPerBlock) {
+			generateBlocks<1>(counter++, buffer.data());
+			bufferIndex = 0;
+		}
+		return buffer[bufferIndex++];
 	}
 
 	std::int_fast64_t operator()(const std::int_fast64_t maximum)
 	{
 		std::uniform_int_distribution<> distr(0, (maximum >= 0) ? maximum - 1 : 0);
-		return distr(mt);
+		return distr(*this);
 	}
 
 	std::int_fast64_t operator()(const std::int_fast64_t minimum, const std::int_fast64_t maximum)
 	{
 		std::uniform_int_distribution<> distr((minimum <= maximum) ? minimum : maximum, (minimum <= maximum) ? maximum : minimum);
-		return distr(mt);
+		return distr(*this);
 	}
 
 	bool Bernoulli(const double probability)
 	{
-		std::bernoulli_distribution distr(probability);
-		return distr(mt);
+		return Uniform() < probability;
 	}
 
 	double Exponential(const double intensity = 1.e0)
 	{
-		std::exponential_distribution<double> distr(intensity);
-		return distr(mt);
+		return ToExponential((*this)()) / intensity;
 	}
 
 	double Logistic(const double location = 0.e0, const double scale = 1.e0)
 	{
-		double u = Uniform();
-		return location + scale * std::log(u / (1.e0 - u));  // 逆関数法による生成。
+		return location + scale * ToLogistic((*this)());
 	}
 
 	double Uniform()
 	{
-		std::uniform_real_distribution<double> distr(0.e0, 1.e0);
-		return distr(mt);
+		return ToUniform((*this)());
 	}
 
 	template<typename T>
 	std::vector<T> Choice(const std::vector<T> population, const std::uint_fast64_t distance)
 	{
 		std::vector<T> result;
-		std::sample(population.begin(), population.end(), std::back_inserter(result), distance, mt);
+		std::sample(population.begin(), population.end(), std::back_inserter(result), distance, *this);
 		return result;
 	}
 
@@ -84,11 +154,122 @@ public:
 	{
 		return Choice(population, 1)[0];
 	}
+
+	// 64ビットの乱数から各分布に従う値への変換。
+	static double ToUniform(const std::uint64_t word)  // [0, 1)
+	{
+		return static_cast<double>(word >> 11) * 0x1.0p-53;
+	}
+
+	static double ToOpenUniform(const std::uint64_t word)  // (0, 1)
+	{
+		return (static_cast<double>(word >> 11) + 0.5e0) * 0x1.0p-53;
+	}
+
+	static double ToExponential(const std::uint64_t word)
+	{
+		return -std::log(ToOpenUniform(word));
+	}
+
+	static double ToLogistic(const std::uint64_t word)
+	{
+		double u = ToOpenUniform(word);
+		return std::log(u / (1.e0 - u));  // 逆関数法による生成。
+	}
+
+	// size個分の乱数列を確保する。スカラー版で使いかけのブロックとは重ならない。
+	Block Reserve(const std::size_t size)
+	{
+		Block block{ counter, size };
+		counter += (size + WordsPerBlock - 1) / WordsPerBlock;
+		bufferIndex = WordsPerBlock;
+		return block;
+	}
+
+	// out[k] = transform(blockのk番目の乱数), first <= k < last. outはblockの先頭に対応する。
+	// 区間の端でも同じ命令で計算されるように、Lanes個のブロックを単位として常にまとめて変換する。
+	template<typename Transform>
+	void Fill(const Block& block, double* out, const std::size_t first, const std::size_t last, Transform transform) const
+	{
+		constexpr std::size_t ChunkSize = Lanes * WordsPerBlock;
+		std::array<std::uint64_t, ChunkSize> words;
+		std::array<double, ChunkSize> values;
+		for (auto chunk = first / ChunkSize * ChunkSize; chunk < last; chunk += ChunkSize) {
+			generateBlocks<Lanes>(block.counter + chunk / WordsPerBlock, words.data());
+			for (std::size_t j = 0; j < ChunkSize; j++)
+				values[j] = transform(words[j]);
+			for (auto k = std::max(first, chunk); k < std::min(last, chunk + ChunkSize); k++)
+				out[k] = values[k - chunk];
+		}
+	}
+
+	template<typename Transform>
+	void Fill(double* out, const std::size_t size, Transform transform)
+	{
+		Fill(Reserve(size), out, 0, size, transform);
+	}
+
+	void FillUniform(double* out, const std::size_t size)
+	{
+		Fill(out, size, [](const std::uint64_t word) { return ToUniform(word); });
+	}
+
+	void FillExponential(double* out, const std::size_t size)
+	{
+		Fill(out, size, [](const std::uint64_t word) { return ToExponential(word); });
+	}
+
+	void FillLogistic(double* out, const std::size_t size)
+	{
+		Fill(out, size, [](const std::uint64_t word) { return ToLogistic(word); });
+	}
 private:
-	std::random_device rd;
-	std::mt19937_64 mt;
+	static constexpr std::size_t WordsPerBlock = 2;  // 1ブロック = 4 x 32ビット。
+	static constexpr std::size_t Lanes = 32;          // 一括生成でまとめて計算するブロック数。
+
+	std::array<std::uint32_t, 2> key;
+	std::uint64_t stream;
+	std::uint64_t counter;  // 次に使うブロック番号。
+	std::array<std::uint64_t, WordsPerBlock> buffer;
+	std::size_t bufferIndex;
+
+	// ブロック番号 first, ..., first + L - 1 の乱数を計算する。ブロック間に依存がないので、lについてのループはベクトル化される。
+	template<std::size_t L>
+	void generateBlocks(const std::uint64_t first, std::uint64_t* words) const
+	{
+		for (std::size_t l = 0; l < L; l++) {
+			std::uint32_t c0 = static_cast<std::uint32_t>(first + l);
+			std::uint32_t c1 = static_cast<std::uint32_t>((first + l) >> 32);
+			std::uint32_t c2 = static_cast<std::uint32_t>(stream);
+			std::uint32_t c3 = static_cast<std::uint32_t>(stream >> 32);
+			std::uint32_t k0 = key[0], k1 = key[1];
+			for (int round = 0; round < 10; round++) {
+				std::uint64_t p0 = static_cast<std::uint64_t>(0xD2511F53u) * c0;
+				std::uint64_t p1 = static_cast<std::uint64_t>(0xCD9E8D57u) * c2;
+				c0 = static_cast<std::uint32_t>(p1 >> 32) ^ c1 ^ k0;
+				c1 = static_cast<std::uint32_t>(p1);
+				c2 = static_cast<std::uint32_t>(p0 >> 32) ^ c3 ^ k1;
+				c3 = static_cast<std::uint32_t>(p0);
+				k0 += 0x9E3779B9u;
+				k1 += 0xBB67AE85u;
+			}
+			words[WordsPerBlock * l] = c0 | (static_cast<std::uint64_t>(c1) << 32);
+			words[WordsPerBlock * l + 1] = c2 | (static_cast<std::uint64_t>(c3) << 32);
+		}
+	}
 };
 
+// BasicIsingModelの中で使う計装。instrumentationはそのメンバー。定義しなければ引数も評価しない。
+#ifdef SIMULATOR_INSTRUMENTATION
+#define SIMULATOR_CONCAT_IMPL(a, b) a##b
+#define SIMULATOR_CONCAT(a, b) SIMULATOR_CONCAT_IMPL(a, b)
+#define SIMULATOR_COUNT(counter, value) instrumentation.Add(Simulator::InstrumentationRecorder::counter, (value))
+#define SIMULATOR_TIME(counter) Simulator::InstrumentationTimer SIMULATOR_CONCAT(instrumentationTimer, __LINE__)(instrumentation, Simulator::InstrumentationRecorder::counter)
+#else
+#define SIMULATOR_COUNT(counter, value) ((void)0)
+#define SIMULATOR_TIME(counter) ((void)0)
+#endif
+
 namespace Simulator {
 	using Node = std::variant<int, std::string>;
 	using Edge = std::pair<Node, Node>;
@@ -108,25 +289,508 @@ namespace Simulator {
 
 	std::string AlgorithmToStr(const Algorithms algorithm);
 
-	class IsingModel {
+	// HillClimbingで反転するスピンの選び方。いずれもエネルギーが下がるスピンがなくなるまで続ける。
+	enum class HillClimbingStrategies {
+		Steepest,          // エネルギーが最も下がるスピンを反転する。
+		FirstImprovement,  // 添字の順に巡回し、エネルギーが下がるスピンを見つけ次第反転する。
+		Randomized         // FirstImprovementと同じだが、1周毎に巡回の順番をランダムに並べ替える。
+	};
+
+	enum class Spin : int {  // ライブラリ側でも型変換できるように、enum classではなくenumを使う。
+		Down = -1,
+		Up = +1
+	};
+
+	enum class ConfigurationsType {
+		AllDown,
+		AllUp,
+		Uniform
+	};
+
+	// 結合定数の型に対して、積和を計算する型。整数型はあふれないように広げる。
+	template<typename Scalar>
+	struct AccumulatorTraits {
+		using Type = Scalar;
+	};
+
+	template<>
+	struct AccumulatorTraits<std::int8_t> {
+		using Type = std::int32_t;
+	};
+
+	template<>
+	struct AccumulatorTraits<std::int16_t> {
+		using Type = std::int32_t;
+	};
+
+	// IsingModel::Runで記録する物理量。
+	enum class Observables {
+		Energy,
+		EnergyOnBipartiteGraph,
+		Temperature,
+		Magnetization,
+		SIZE
+	};
+
+	enum class StepUnits {
+		Update,  // 1ステップ = Updateの1回の呼び出し。
+		Sweep,   // 1ステップ = N回の1スピン更新（MetropolisとGlauberのみ。他のアルゴリズムではUpdateと同じ）。
+		ColoredSweep  // 1ステップ = 彩色の色毎に、同じ色の頂点を同時に更新する1スイープ（同上）。
+	};
+
+	// 温度などのパラメータをステップ数 n の関数として与える。
+	class Schedule {
 	public:
-		enum class Spin : int {  // ライブラリ側でも型変換できるように、enum classではなくenumを使う。
-			Down = -1,
-			Up = +1
+		enum class Types {
+			Constant,                 // a
+			Logarithmic,              // a / (b log(n + 1) + 1)
+			LinearMultiplicative,     // a / (b n + 1)
+			QuadraticMultiplicative,  // a / (b n^2 + 1)
+			LinearAdditive,           // a + (c - a) n / m  (n >= m ではc)
+			Exponential,              // a b^n
+			Piecewise,                // 点 (n_k, v_k) の間を線形補間する。
+			Tabulated                 // v_n（表の外では端の値）
 		};
-		enum class ConfigurationsType {
-			AllDown,
-			AllUp,
-			Uniform
+
+		Schedule() : Schedule(Types::Constant, 0.e0, 0.e0, 0.e0, 0) {}
+
+		static Schedule Constant(const double value)
+		{
+			return Schedule(Types::Constant, value, 0.e0, value, 0);
+		}
+
+		static Schedule Logarithmic(const double initialValue, const double coefficient = 1.e0)
+		{
+			return Schedule(Types::Logarithmic, initialValue, coefficient, 0.e0, 0);
+		}
+
+		static Schedule LinearMultiplicative(const double initialValue, const double coefficient = 1.e0)
+		{
+			return Schedule(Types::LinearMultiplicative, initialValue, coefficient, 0.e0, 0);
+		}
+
+		static Schedule QuadraticMultiplicative(const double initialValue, const double coefficient = 1.e0)
+		{
+			return Schedule(Types::QuadraticMultiplicative, initialValue, coefficient, 0.e0, 0);
+		}
+
+		static Schedule LinearAdditive(const double initialValue, const double finalValue, const std::size_t steps)
+		{
+			return Schedule(Types::LinearAdditive, initialValue, 0.e0, finalValue, steps);
+		}
+
+		static Schedule Exponential(const double initialValue, const double rate)
+		{
+			return Schedule(Types::Exponential, initialValue, rate, 0.e0, 0);
+		}
+
+		static Schedule Piecewise(const std::vector<std::pair<std::size_t, double>>& points);
+		static Schedule Tabulated(const std::vector<double>& values);
+		double operator()(const std::size_t step) const;
+
+		Types GetType() const
+		{
+			return type;
+		}
+	private:
+		Types type;
+		double initialValue;
+		double coefficient;
+		double finalValue;
+		std::size_t steps;
+		std::vector<std::size_t> points;
+		std::vector<double> values;
+
+		Schedule(const Types type, const double initialValue, const double coefficient, const double finalValue, const std::size_t steps)
+			: type(type), initialValue(initialValue), coefficient(coefficient), finalValue(finalValue), steps(steps) {}
+	};
+
+	class TrajectoryWriter;
+
+	struct RunOptions {
+		std::vector<Observables> observables;
+		StepUnits stepUnit = StepUnits::Update;
+
+		// 指定されていれば、各ステップの前に schedule(firstStep + n) を設定する。
+		std::optional<Schedule> temperatureSchedule;
+		std::optional<Schedule> pinningParameterSchedule;
+		std::optional<Schedule> flipTrialRateSchedule;
+		std::size_t firstStep = 0;
+
+		// 0でなければ、snapshotIntervalステップ毎にその直後のスピン配位を記録する。
+		std::size_t snapshotInterval = 0;
+
+		// 指定されていれば、各ステップの直後の値をステップ数 firstStep + n として渡す。Trajectoryとは独立。
+		std::shared_ptr<TrajectoryWriter> trajectoryWriter;
+
+		// 指定されていれば、各ステップの直後に終えたステップ数 n + 1 を渡して呼ぶ。falseを返せばそこで止め、Trajectoryは終えたステップまでに縮める。
+		std::function<bool(std::size_t)> stepCallback;
+	};
+
+	// 各ステップの直後の値。記録しなかった物理量は空のまま。
+	struct Trajectory {
+		Eigen::VectorXd energies;
+		Eigen::VectorXd energiesOnBipartiteGraph;
+		Eigen::VectorXd temperatures;
+		Eigen::VectorXd magnetizations;
+		// k行目は (k + 1) * snapshotInterval ステップ目の直後のスピン配位。
+		Eigen::Matrix<std::int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> spinSnapshots;
+	};
+
+	// IsingModelの内部の計数と時間。SIMULATOR_INSTRUMENTATIONを定義してビルドした場合（make INSTRUMENTATION=1）だけ記録し、
+	// 定義しなければ記録の処理はすべて消えて0のままになる。時間はスレッドで分けた部分では各スレッドの和。
+	// MetropolisとGlauberのUpdateでは、1回毎の乱数と採択判定は短すぎるので時間を測らない（Sweepでは測る）。
+	struct Instrumentation {
+		std::uint64_t proposals = 0;            // 反転を試みたスピンの数。同期更新では1ステップでN.
+		std::uint64_t acceptedFlips = 0;        // 実際に反転したスピンの数。
+		std::uint64_t synchronousSteps = 0;     // SCA, fcSCA, MA, MMAのステップ数。
+		std::uint64_t synchronousFlips = 0;     // そのうち反転したスピンの数。
+		std::uint64_t fieldRecalculations = 0;  // 局所磁場を J s + h から計算し直した回数。
+		std::uint64_t fieldColumnUpdates = 0;   // 差分更新で局所磁場に結合定数の列を足した回数。
+		double fieldSeconds = 0.e0;             // 局所磁場の計算。
+		double randomSeconds = 0.e0;            // 乱数の生成。
+		double acceptanceSeconds = 0.e0;        // 符号関数と採択の判定。
+		double copySeconds = 0.e0;              // previousSpinsへの複製。
+	};
+
+	// スレッドから同時に加えられるように原子的に数える。複製は0から数え直し、移動では値を引き継ぐ。
+	class InstrumentationRecorder {
+	public:
+		enum Counter {
+			Proposals,
+			AcceptedFlips,
+			SynchronousSteps,
+			SynchronousFlips,
+			FieldRecalculations,
+			FieldColumnUpdates,
+			FieldNanoseconds,
+			RandomNanoseconds,
+			AcceptanceNanoseconds,
+			CopyNanoseconds,
+			NumCounters
 		};
 
-		IsingModel(const LinearBiases linear, const QuadraticBiases quadratic);
-		double CalcLargestEigenvalue() const;
+		InstrumentationRecorder()
+		{
+			Reset();
+		}
+
+		InstrumentationRecorder(const InstrumentationRecorder&) : InstrumentationRecorder() {}
+
+		InstrumentationRecorder(InstrumentationRecorder&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+
+		InstrumentationRecorder& operator=(InstrumentationRecorder&& other) noexcept
+		{
+			for (std::size_t k = 0; k < values.size(); k++)
+				values[k].store(other.values[k].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			return *this;
+		}
+
+		void Add(const Counter counter, const std::uint64_t value)
+		{
+			values[counter].fetch_add(value, std::memory_order_relaxed);
+		}
+
+		void Reset()
+		{
+			for (auto& value : values)
+				value.store(0, std::memory_order_relaxed);
+		}
+
+		Instrumentation Get() const
+		{
+			auto load = [this](const Counter counter) { return values[counter].load(std::memory_order_relaxed); };
+			return { load(Proposals), load(AcceptedFlips), load(SynchronousSteps), load(SynchronousFlips), load(FieldRecalculations), load(FieldColumnUpdates),
+				load(FieldNanoseconds) * 1.e-9, load(RandomNanoseconds) * 1.e-9, load(AcceptanceNanoseconds) * 1.e-9, load(CopyNanoseconds) * 1.e-9 };
+		}
+	private:
+		std::array<std::atomic<std::uint64_t>, NumCounters> values;
+	};
+
+	// 生存期間の長さを加える。
+	class InstrumentationTimer {
+	public:
+		InstrumentationTimer(InstrumentationRecorder& recorder, const InstrumentationRecorder::Counter counter)
+			: recorder(recorder), counter(counter), start(std::chrono::steady_clock::now()) {}
+
+		~InstrumentationTimer()
+		{
+			recorder.Add(counter, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+		}
+	private:
+		InstrumentationRecorder& recorder;
+		InstrumentationRecorder::Counter counter;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	// 結合定数を表す対称行列。非零成分の割合が小さい場合はCSR形式で、そうでない場合は密行列で保持する。
+	// 成分の型を小さくすれば、行列ベクトル積で読み込むバイト数が減る。
+	template<typename Scalar>
+	class BasicCouplingMatrix {
+	public:
+		using Accumulator = typename AccumulatorTraits<Scalar>::Type;
+		using DenseMatrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+		using FieldVector = Eigen::Matrix<Accumulator, Eigen::Dynamic, 1>;
+
+		struct Triplet {
+			std::size_t row;
+			std::size_t column;
+			Scalar value;
+		};
+
+		// これ以下の密度（非零成分の個数 / N^2）ならばCSR形式を選ぶ。
+		static constexpr double SparsityThreshold = 0.25e0;
+
+		BasicCouplingMatrix() : size(0), sparse(false) {}
+		BasicCouplingMatrix(const std::size_t size, const std::vector<Triplet>& upperTriangle);
+		BasicCouplingMatrix(const std::size_t size, const Scalar* dense, std::shared_ptr<const void> storage);
+		BasicCouplingMatrix(const std::size_t size, const std::int64_t* rowOffsets, const std::int32_t* columnIndices, const Scalar* values,
+			std::shared_ptr<const void> storage);
+		BasicCouplingMatrix(const BasicCouplingMatrix&) = delete;  // 成分のビューが複製元の領域を指したままになるので、複製しない。
+		BasicCouplingMatrix& operator=(const BasicCouplingMatrix&) = delete;
+		DenseMatrix ToDense() const;
+
+		std::size_t Size() const
+		{
+			return size;
+		}
+
+		bool IsSparse() const
+		{
+			return sparse;
+		}
+
+		std::size_t NonZeros() const
+		{
+			return sparse ? numNonZeros : static_cast<std::size_t>((dense.array() != Scalar(0)).count());
+		}
+
+		// 生の配列。密行列ならば列優先の size * size 個の成分、CSR形式ならば行の先頭位置、列番号と値。
+		const Scalar* DenseData() const
+		{
+			return dense.data();
+		}
+
+		const std::int64_t* RowOffsets() const
+		{
+			return rowOffsets;
+		}
+
+		const std::int32_t* ColumnIndices() const
+		{
+			return columnIndices;
+		}
+
+		const Scalar* Values() const
+		{
+			return values;
+		}
+
+		// (J x)_row
+		template<typename Derived>
+		Accumulator RowDot(const std::size_t row, const Eigen::MatrixBase<Derived>& x) const
+		{
+			if (!sparse) {  // Jは対称なので、連続な列を使う。
+				if constexpr (std::is_integral_v<Scalar>) {
+					FieldVector widened = x.template cast<Accumulator>();
+					return widenedDot(dense.col(row).data(), widened.data());
+				} else {
+					return dense.col(row).dot(x.template cast<Scalar>());
+				}
+			}
+			Accumulator result = 0;
+			for (auto k = rowOffsets[row]; k < rowOffsets[row + 1]; k++)
+				result += static_cast<Accumulator>(values[k]) * static_cast<Accumulator>(x(columnIndices[k]));
+			return result;
+		}
+
+		Scalar Diagonal(const std::size_t row) const
+		{
+			if (!sparse)
+				return dense(row, row);
+			auto begin = columnIndices + rowOffsets[row];
+			auto end = columnIndices + rowOffsets[row + 1];
+			auto iter = std::lower_bound(begin, end, static_cast<std::int32_t>(row));
+			return (iter != end && static_cast<std::size_t>(*iter) == row) ? values[iter - columnIndices] : Scalar(0);
+		}
+
+		// 非零成分 J_{row, column} について f(column, J_{row, column}) を呼ぶ。
+		template<typename Function>
+		void ForEachInRow(const std::size_t row, Function f) const
+		{
+			if (!sparse) {
+				for (std::size_t column = 0; column < size; column++)
+					if (dense(column, row) != Scalar(0))
+						f(column, dense(column, row));
+				return;
+			}
+			for (auto k = rowOffsets[row]; k < rowOffsets[row + 1]; k++)
+				f(static_cast<std::size_t>(columnIndices[k]), values[k]);
+		}
+
+		// target += scale * J_{., column}
+		void AddColumnTo(FieldVector& target, const std::size_t column, const Accumulator scale) const
+		{
+			if (!sparse) {
+				target += scale * dense.col(column).template cast<Accumulator>();
+				return;
+			}
+			for (auto k = rowOffsets[column]; k < rowOffsets[column + 1]; k++)  // Jは対称なので、行を列として使う。
+				target(columnIndices[k]) += scale * static_cast<Accumulator>(values[k]);
+		}
+
+		// target(row) += scale * J_{row, column}, first <= row < first + count. 行の区間が重ならなければ、並列に呼んでよい。
+		void AddColumnTo(FieldVector& target, const std::size_t column, const Accumulator scale, const std::size_t first, const std::size_t count) const
+		{
+			if (!sparse) {
+				target.segment(first, count) += scale * dense.col(column).segment(first, count).template cast<Accumulator>();
+				return;
+			}
+			auto begin = columnIndices + rowOffsets[column];
+			auto end = columnIndices + rowOffsets[column + 1];
+			for (auto iter = std::lower_bound(begin, end, static_cast<std::int32_t>(first)); iter != end && static_cast<std::size_t>(*iter) < first + count; iter++)
+				target(*iter) += scale * static_cast<Accumulator>(values[iter - columnIndices]);
+		}
+
+		// result(row) = (J x)_row, first <= row < first + count. 行の区間が重ならなければ、並列に呼んでよい。
+		void MultiplyRows(const FieldVector& x, FieldVector& result, const std::size_t first, const std::size_t count) const
+		{
+			if (sparse) {
+				for (auto row = first; row < first + count; row++)
+					result(row) = RowDot(row, x);
+			} else if constexpr (std::is_floating_point_v<Scalar>) {
+				result.segment(first, count).noalias() = dense.middleCols(first, count).transpose() * x;
+			} else {
+				for (auto row = first; row < first + count; row++)
+					result(row) = widenedDot(dense.col(row).data(), x.data());
+			}
+		}
+
+		// J x を倍精度で計算する。整数型でもxを丸めない。
+		Eigen::VectorXd MultiplyInDouble(const Eigen::VectorXd& x) const
+		{
+			Eigen::VectorXd result(size);
+			if (!sparse) {
+				if constexpr (std::is_same_v<Scalar, double>) {
+					result.noalias() = dense * x;
+				} else {  // 行列全体を変換すると大きな一時領域が要るので、列毎に変換する。
+					for (std::size_t row = 0; row < size; row++)
+						result(row) = dense.col(row).template cast<double>().dot(x);
+				}
+				return result;
+			}
+			for (std::size_t row = 0; row < size; row++) {
+				double sum = 0.e0;
+				for (auto k = rowOffsets[row]; k < rowOffsets[row + 1]; k++)
+					sum += static_cast<double>(values[k]) * x(columnIndices[k]);
+				result(row) = sum;
+			}
+			return result;
+		}
+
+		// J x（xはベクトルでも、列ごとにレプリカを並べた行列でもよい）
+		template<typename Derived>
+		Eigen::Matrix<Accumulator, Eigen::Dynamic, Derived::ColsAtCompileTime> Multiply(const Eigen::MatrixBase<Derived>& x) const
+		{
+			using Result = Eigen::Matrix<Accumulator, Eigen::Dynamic, Derived::ColsAtCompileTime>;
+			if constexpr (std::is_floating_point_v<Scalar>) {
+				if (!sparse)
+					return dense * x.template cast<Scalar>();
+			}
+			Result result = Result::Zero(size, x.cols());
+			if (!sparse) {  // 整数型の積はあふれるので、広げた型で計算する。
+				if constexpr (Derived::ColsAtCompileTime == 1) {
+					FieldVector widened = x.template cast<Accumulator>();
+					for (std::size_t row = 0; row < size; row++)
+						result(row) = widenedDot(dense.col(row).data(), widened.data());
+				} else {
+					for (std::size_t column = 0; column < size; column++)
+						result += dense.col(column).template cast<Accumulator>() * x.row(column).template cast<Accumulator>();
+				}
+			} else if constexpr (Derived::ColsAtCompileTime == 1) {
+				for (std::size_t row = 0; row < size; row++)
+					result(row) = RowDot(row, x);
+			} else {
+				for (std::size_t row = 0; row < size; row++)
+					for (auto k = rowOffsets[row]; k < rowOffsets[row + 1]; k++)
+						result.row(row) += static_cast<Accumulator>(values[k]) * x.row(columnIndices[k]).template cast<Accumulator>();
+			}
+			return result;
+		}
+	private:
+		std::size_t size;
+		bool sparse;
+		std::shared_ptr<const void> externalStorage;  // 外部の領域（ファイルを写像した領域など）を使う場合に、その寿命を保つ。
+		// 自前で確保した領域。
+		DenseMatrix denseStorage;
+		std::vector<std::int64_t> rowOffsetsStorage;
+		std::vector<std::int32_t> columnIndicesStorage;
+		std::vector<Scalar> valuesStorage;
+		// 成分は以下を通して読む。自前の領域か、外部の領域を指す。
+		Eigen::Map<const DenseMatrix> dense{ nullptr, 0, 0 };
+		const std::int64_t* rowOffsets = nullptr;
+		const std::int32_t* columnIndices = nullptr;
+		const Scalar* values = nullptr;
+		std::size_t numNonZeros = 0;
+
+		void setViews();
+
+		// 自動ベクトル化されるように、単純なループで書く。
+		Accumulator widenedDot(const Scalar* column, const Accumulator* x) const
+		{
+			Accumulator result = 0;
+			for (std::size_t row = 0; row < size; row++)
+				result += static_cast<Accumulator>(column[row]) * x[row];
+			return result;
+		}
+	};
+
+	using CouplingMatrix = BasicCouplingMatrix<double>;
+
+	// Scalarは外部磁場と結合定数の型（double, float, std::int16_t, std::int8_t）。
+	// 整数型の場合、局所磁場はAccumulatorTraitsの型で厳密に計算する。
+	template<typename Scalar>
+	class BasicIsingModel {
+	public:
+		using Spin = Simulator::Spin;
+		using ConfigurationsType = Simulator::ConfigurationsType;
+		using CouplingMatrixType = BasicCouplingMatrix<Scalar>;
+
+		BasicIsingModel(const LinearBiases linear, const QuadraticBiases quadratic);
+		BasicIsingModel(const Eigen::VectorXd& linear, const std::vector<std::size_t>& rows, const std::vector<std::size_t>& columns,
+			const std::vector<double>& weights, const std::vector<Node>& labels = {});
+		BasicIsingModel(const Eigen::VectorXd& linear, std::shared_ptr<const CouplingMatrixType> couplingCoefficients, const std::vector<Node>& labels = {});
+		BasicIsingModel(const BasicIsingModel& other);
+		// 移動ではスレッドプールも引き継ぐ。
+		BasicIsingModel(BasicIsingModel&& other) = default;
+		BasicIsingModel& operator=(BasicIsingModel&& other) = default;
+
+		// 頂点を 0, ..., N - 1 の添字で表し、結合定数をCOO形式 J_{rows[k], columns[k]} = weights[k] で与える。辺の数に比例する時間で構築できる。
+		// 各辺は片方の向きだけを与える（両方の向きや同じ辺を重ねて与えると、足し合わされる）。
+		// labelsは頂点の名前で、GetSpinsAsDictionaryなどで使う。省略した場合は添字をそのまま名前とする。
+		static BasicIsingModel FromCoo(const Eigen::VectorXd& linear, const std::vector<std::size_t>& rows, const std::vector<std::size_t>& columns,
+			const std::vector<double>& weights, const std::vector<Node>& labels = {})
+		{
+			return BasicIsingModel(linear, rows, columns, weights, labels);
+		}
+		// 行列 -J の最大固有値。残差が tolerance * ‖J‖ 以下になるまでLanczos法を続ける。maxIterations回で達しなければ、
+		// 頂点数が1024以下ならば密行列として対角化し、それより大きければ std::runtime_error を投げる。
+		double CalcLargestEigenvalue(const double tolerance = 1.e-6, const std::size_t maxIterations = 300) const;
 		double GetEnergy() const;
 		double GetEnergyOnBipartiteGraph() const;
 		void GiveSpins(const ConfigurationsType configurationType);
 		void Update();
+		void Sweep();
+		Trajectory Run(const std::size_t steps, const RunOptions& options = {});
 		void Write() const;
+		// チェックポイント: スピン配位、直前の配位、温度などの設定、乱数生成器の状態と差分更新する量を二値形式で書き出す。
+		// 結合定数、外部磁場と頂点の名前は含まないので、同じモデルから作ったインスタンスに読み込む。
+		// 読み込んだ後の実行結果は、書き出した時点から続けた場合とビット単位で一致する。
+		void SaveCheckpoint(std::ostream& stream) const;
+		void LoadCheckpoint(std::istream& stream);
 
 		void SetSeed()
 		{
@@ -139,6 +803,12 @@ namespace Simulator {
 			rand->Seed(seed);
 		}
 
+		// レプリカ毎に同じシードで別のストリームを使えば、互いに独立な乱数列になる。
+		void SetSeed(const unsigned int seed, const std::uint64_t stream)
+		{
+			rand = std::make_unique<Rand>(seed, stream);
+		}
+
 		Algorithms GetCurrentAlgorithm() const
 		{
 			return algorithm;
@@ -179,18 +849,77 @@ namespace Simulator {
 			this->flipTrialRate = std::min(std::max(flipTrialRate, 0.e0), 1.e0);
 		}
 
+		HillClimbingStrategies GetHillClimbingStrategy() const
+		{
+			return hillClimbingStrategy;
+		}
+
+		void SetHillClimbingStrategy(const HillClimbingStrategies hillClimbingStrategy)
+		{
+			this->hillClimbingStrategy = hillClimbingStrategy;
+		}
+
+		// 添字の順の頂点の名前。名前を持たない（添字をそのまま名前とする）場合は空。
+		std::vector<Node> GetNodeLabels() const
+		{
+			std::vector<Node> labels(nodeIndices.size());
+			for (const auto& node : nodeIndices)
+				labels[node.second] = node.first;
+			return labels;
+		}
+
 		std::map<Node, Spin> GetSpinsAsDictionary() const
 		{
 			std::map<Node, Spin> result;
+			if (nodeIndices.empty()) {
+				for (auto i = 0; i < spins.size(); i++)
+					result[i] = spins[i];
+			}
 			for (const auto& node : nodeIndices)
 				result[node.first] = spins[node.second];
 			return result;
 		}
 
+		// 未知の頂点があれば、何も変えずに例外を投げる。
 		void SetSpinsAsDictionary(const std::map<Node, Spin> spins)
 		{
+			std::vector<std::pair<std::size_t, Spin>> indexedSpins;
+			indexedSpins.reserve(spins.size());
 			for (const auto& spin : spins)
-				this->spins[nodeIndices[spin.first]] = spin.second;
+				indexedSpins.emplace_back(nodeIndex(spin.first), spin.second);
+			for (const auto& spin : indexedSpins)
+				this->spins[spin.first] = spin.second;
+			recalculateCaches();
+		}
+
+		// 添字の順のスピン配位をまとめて設定する。変わったスピンが少なければ差分だけ更新する。
+		void SetSpins(const Eigen::Ref<const Eigen::VectorXi>& spins)
+		{
+			if (spins.size() != this->spins.size())
+				throw std::invalid_argument("IsingModel: the number of spins differs from the number of nodes.");
+			Configuration nextSpins(spins.size());
+			for (auto i = 0; i < spins.size(); i++) {
+				if (spins(i) != -1 && spins(i) != +1)
+					throw std::invalid_argument("IsingModel: spins must be -1 or +1.");
+				nextSpins(i) = static_cast<Spin>(spins(i));
+			}
+			updateSpins(nextSpins);
+		}
+
+		// 内部の配列の先頭。大きさは変わらないので、モデルが存在する間は同じ場所を指し続ける（複製せずに読むため）。
+		const Spin* SpinData() const
+		{
+			return spins.data();
+		}
+
+		const typename CouplingMatrixType::Accumulator* ExternalMagneticFieldData() const
+		{
+			return externalMagneticField.data();
+		}
+
+		double GetMagnetization() const
+		{
+			return spinSum / spins.size();
 		}
 
 		Eigen::VectorXi GetSpins() const
@@ -200,35 +929,221 @@ namespace Simulator {
 
 		Eigen::VectorXd GetExternalMagneticField() const
 		{
-			return externalMagneticField;
+			return externalMagneticField.template cast<double>();
 		}
 
 		Eigen::MatrixXd GetCouplingCoefficients() const
+		{
+			return couplingCoefficients->ToDense().template cast<double>();
+		}
+
+		bool HasSparseCouplings() const
+		{
+			return couplingCoefficients->IsSparse();
+		}
+
+		std::shared_ptr<const CouplingMatrixType> GetCouplingMatrix() const
 		{
 			return couplingCoefficients;
 		}
+
+		// SCA, fcSCA, MA, MMAの更新と局所磁場の計算を、行をChunkSize行毎に区切ってnumThreads個のスレッドで行う。
+		// 区切り方はスレッド数に依らないので、一度設定すれば、同じシードからはスレッド数に依らず同じ結果になる。
+		void SetNumThreads(const std::size_t numThreads)
+		{
+			threadPool = std::make_unique<ThreadPool>(std::max<std::size_t>(numThreads, 1));
+		}
+
+		std::size_t GetNumThreads() const
+		{
+			return threadPool ? threadPool->GetNumThreads() : 1;
+		}
+
+		// 計装付きでビルドしていなければ、すべて0.
+		Instrumentation GetInstrumentation() const
+		{
+			return instrumentation.Get();
+		}
+
+		void ResetInstrumentation()
+		{
+			instrumentation.Reset();
+		}
+
+		static bool IsInstrumented()
+		{
+#ifdef SIMULATOR_INSTRUMENTATION
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// Sweepで使う、結合グラフの貪欲彩色の色数。
+		std::size_t GetNumColors() const
+		{
+			return colorOffsets.size() - 1;
+		}
 	private:
 		using Configuration = Eigen::Matrix<Spin, Eigen::Dynamic, 1>;
+		using FieldVector = typename CouplingMatrixType::FieldVector;
+		using Accumulator = typename CouplingMatrixType::Accumulator;
+
+		static constexpr std::size_t ChunkSize = 256;
 
 		std::unique_ptr<Rand> rand;
+		std::unique_ptr<ThreadPool> threadPool;  // nullptrならば呼び出したスレッドだけで計算する。複製には引き継がない。
+		mutable InstrumentationRecorder instrumentation;
 		double temperature;        // Including the Boltzmann constant: k_B T.
 		double pinningParameter;   // Pinning parameter of SCA.
 		double flipTrialRate;      // Flip trial rate of flip-constained SCA.
 		Algorithms algorithm;
-		std::map<Node, std::size_t> nodeIndices;
+		HillClimbingStrategies hillClimbingStrategy;
+		std::map<Node, std::size_t> nodeIndices;  // 頂点の名前から添字への対応。空ならば添字をそのまま名前とする。
 		Configuration spins;
 		Configuration previousSpins;
-		Eigen::VectorXd externalMagneticField;
-		Eigen::MatrixXd couplingCoefficients;
+		FieldVector externalMagneticField;
+		std::shared_ptr<const CouplingMatrixType> couplingCoefficients;  // 変更しないので、レプリカ間で共有できる。
+		// 色cの頂点は coloredNodes[colorOffsets[c]], ..., coloredNodes[colorOffsets[c + 1] - 1]. 同じ色の頂点の間に結合はない。
+		std::vector<std::size_t> colorOffsets;
+		std::vector<std::size_t> coloredNodes;
+		// 収束したCalcLargestEigenvalueの結果と、そのとき達した 残差 / ‖J‖.結合定数は変わらないので、より緩い許容誤差の呼び出しにはこれを返す。
+		mutable std::optional<double> largestEigenvalue;
+		mutable double largestEigenvalueTolerance;
+		// 以下はスピンが変わるたびに差分だけ更新する。
+		FieldVector localMagneticField;      // J s + h.
+		double energy;                       // H(s) = -s^T J s / 2 - h^T s.
+		double halfFieldDifference;          // h^T (s - s') / 2, where s' denotes previousSpins.
+		double overlap;                      // s^T s'.
+		double spinSum;                      // sum_i s_i.
+
+		void initialize(const std::vector<typename CouplingMatrixType::Triplet>& upperTriangle);
+		void initialize(std::shared_ptr<const CouplingMatrixType> couplingCoefficients);
+		void setNodeLabels(const std::vector<Node>& labels);
+		std::size_t updateSpins(const Configuration& nextSpins);
+		void advanceSynchronously(const Configuration& nextSpins);
+		void addToLocalField(const std::vector<std::size_t>& nodes, const std::vector<int>& differences);
+		void recalculateCaches();
+		void colorNodes();
+		void climbHill();
+		double improvementThreshold() const;
+		template<Algorithms Kernel> void update();
+		template<Algorithms Kernel> void updateSingleSpin();
+		template<Algorithms Kernel> void updateSynchronously();
+		template<Algorithms Kernel> std::size_t runSteps(const std::size_t steps, const RunOptions& options, Trajectory& trajectory);
+
+		// 現在のアルゴリズムを std::integral_constant<Algorithms, .> にしてfunctionに渡す。アルゴリズムによる分岐はここだけで行う。
+		template<typename Function>
+		void dispatch(Function&& function)
+		{
+			switch (algorithm) {
+			case Algorithms::Metropolis:
+				function(std::integral_constant<Algorithms, Algorithms::Metropolis>{});
+				break;
+			case Algorithms::Glauber:
+				function(std::integral_constant<Algorithms, Algorithms::Glauber>{});
+				break;
+			case Algorithms::SCA:
+				function(std::integral_constant<Algorithms, Algorithms::SCA>{});
+				break;
+			case Algorithms::fcSCA:
+				function(std::integral_constant<Algorithms, Algorithms::fcSCA>{});
+				break;
+			case Algorithms::MA:
+				function(std::integral_constant<Algorithms, Algorithms::MA>{});
+				break;
+			case Algorithms::MMA:
+				function(std::integral_constant<Algorithms, Algorithms::MMA>{});
+				break;
+			case Algorithms::HillClimbing:
+				function(std::integral_constant<Algorithms, Algorithms::HillClimbing>{});
+				break;
+			default:
+				break;
+			}
+		}
 
-		double calcLocalMagneticField(const unsigned int nodeIndex) const
+		std::size_t nodeIndex(const Node& node) const
 		{
-			return (couplingCoefficients * spins.cast<double>())(nodeIndex) + externalMagneticField(nodeIndex);
+			if (nodeIndices.empty()) {
+				auto index = std::get_if<int>(&node);
+				if (!index || *index < 0 || *index >= spins.size())
+					throw std::out_of_range("IsingModel: unknown node.");
+				return static_cast<std::size_t>(*index);
+			}
+			auto iter = nodeIndices.find(node);
+			if (iter == nodeIndices.end())
+				throw std::out_of_range("IsingModel: unknown node.");
+			return iter->second;
 		}
 
-		Eigen::VectorXd calcLocalMagneticField(const Configuration& spins) const
+		// スピンiを反転したときのエネルギー差 H(s + d) - H(s) = 2 s_i f_i - 2 J_{ii}.
+		double flipEnergyDifference(const std::size_t i) const
 		{
-			return couplingCoefficients * spins.cast<double>() + externalMagneticField;
+			return 2.e0 * static_cast<int>(spins(i)) * static_cast<double>(localMagneticField(i)) - 2.e0 * static_cast<double>(couplingCoefficients->Diagonal(i));
+		}
+
+		void recalculateBipartiteTerms()
+		{
+			halfFieldDifference = 0.5e0 * sumOverRowRanges([this](const std::size_t first, const std::size_t count) {
+				return externalMagneticField.segment(first, count).template cast<double>().dot(spins.segment(first, count).cast<double>() - previousSpins.segment(first, count).cast<double>());
+			});
+			overlap = sumOverRowRanges([this](const std::size_t first, const std::size_t count) {
+				return spins.segment(first, count).cast<double>().dot(previousSpins.segment(first, count).cast<double>());
+			});
+		}
+
+		// f(first, count) を行の区間 [first, first + count) 毎に呼ぶ。スレッドプールがなければ全体で1回だけ呼ぶ。
+		template<typename Function>
+		void forEachRowRange(Function f) const
+		{
+			forEachRange(static_cast<std::size_t>(spins.size()), f);
+		}
+
+		// [0, size) をChunkSize毎に区切って f(first, count) を呼ぶ。
+		template<typename Function>
+		void forEachRange(const std::size_t size, Function f) const
+		{
+			if (!threadPool) {
+				f(0, size);
+				return;
+			}
+			threadPool->ParallelFor((size + ChunkSize - 1) / ChunkSize, [&f, size](const std::size_t chunk) {
+				f(chunk * ChunkSize, std::min(ChunkSize, size - chunk * ChunkSize));
+			});
+		}
+
+		// 区間毎の部分和を区間の順に足し合わせるので、スレッド数に依らない。
+		template<typename Function>
+		double sumOverRowRanges(Function f) const
+		{
+			std::vector<double> partialSums((spins.size() + ChunkSize - 1) / ChunkSize + 1, 0.e0);
+			forEachRowRange([&f, &partialSums](const std::size_t first, const std::size_t count) {
+				partialSums[first / ChunkSize] = f(first, count);
+			});
+			double sum = 0.e0;
+			for (const auto partialSum : partialSums)
+				sum += partialSum;
+			return sum;
+		}
+
+		// H(s + d) - H(s) = -d^T (f(s) + f(s + d)) / 2, where f(s) = J s + h.
+		void flipSpin(const std::size_t nodeIndex)
+		{
+			double previousField = localMagneticField(nodeIndex);
+			Spin nextSpin = flip(spins(nodeIndex));
+			int difference = static_cast<int>(nextSpin) - static_cast<int>(spins(nodeIndex));
+			spins(nodeIndex) = nextSpin;
+			SIMULATOR_COUNT(AcceptedFlips, 1);
+			SIMULATOR_COUNT(FieldColumnUpdates, 1);
+			{
+				SIMULATOR_TIME(FieldNanoseconds);
+				couplingCoefficients->AddColumnTo(localMagneticField, nodeIndex, difference);
+			}
+			energy -= 0.5e0 * difference * (previousField + localMagneticField(nodeIndex));
+			halfFieldDifference += 0.5e0 * difference * externalMagneticField(nodeIndex);
+			overlap += difference * static_cast<int>(previousSpins(nodeIndex));
+			spinSum += difference;
 		}
 
 		Spin flip(const Spin spin) const
@@ -236,6 +1151,17 @@ namespace Simulator {
 			return (spin == Spin::Down) ? Spin::Up : Spin::Down;
 		}
 	};
+
+	using IsingModel = BasicIsingModel<double>;
+
+	extern template class BasicCouplingMatrix<double>;
+	extern template class BasicCouplingMatrix<float>;
+	extern template class BasicCouplingMatrix<std::int16_t>;
+	extern template class BasicCouplingMatrix<std::int8_t>;
+	extern template class BasicIsingModel<double>;
+	extern template class BasicIsingModel<float>;
+	extern template class BasicIsingModel<std::int16_t>;
+	extern template class BasicIsingModel<std::int8_t>;
 }
 
 #endif // !SIMULATOR_H
@@ -0,0 +1,88 @@
+﻿#include "thread_pool.h"
+#include <algorithm>
+#include <utility>
+
+using namespace Simulator;
+
+ThreadPool::ThreadPool(const std::size_t numThreads)
+{
+	for (std::size_t i = 1; i < std::max<std::size_t>(numThreads, 1); i++)
+		workers.emplace_back([this]() { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isStopping = true;
+	}
+	wakeUp.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::ParallelFor(const std::size_t count, const std::function<void(std::size_t)>& task)
+{
+	if (count == 0)
+		return;
+	if (workers.empty() || count == 1) {
+		for (std::size_t i = 0; i < count; i++)
+			task(i);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentTask = &task;
+		taskCount = count;
+		nextIndex = 0;
+		activeWorkers = workers.size();
+		generation++;
+	}
+	wakeUp.notify_all();
+	runTasks(task, count);
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return activeWorkers == 0; });
+	currentTask = nullptr;
+	auto taskError = std::exchange(error, nullptr);
+	lock.unlock();
+	if (taskError)
+		std::rethrow_exception(taskError);
+}
+
+void ThreadPool::work()
+{
+	std::size_t seenGeneration = 0;
+	while (true) {
+		const std::function<void(std::size_t)>* task;
+		std::size_t count;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [this, seenGeneration]() { return isStopping || generation != seenGeneration; });
+			if (isStopping)
+				return;
+			seenGeneration = generation;
+			task = currentTask;
+			count = taskCount;
+		}
+		runTasks(*task, count);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		finished.notify_one();
+	}
+}
+
+// 添字を1つずつ取り合うので、負荷が偏っていても全スレッドが最後まで働く。
+void ThreadPool::runTasks(const std::function<void(std::size_t)>& task, const std::size_t count)
+{
+	try {
+		for (auto i = nextIndex++; i < count; i = nextIndex++)
+			task(i);
+	} catch (...) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!error)
+			error = std::current_exception();
+		nextIndex = count;  // 他のスレッドも、実行中の添字を終えたら止まる。
+	}
+}
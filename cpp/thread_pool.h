@@ -0,0 +1,48 @@
+﻿#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Simulator {
+	// 常駐するワーカースレッドの集まり。ParallelForを呼んだスレッドも計算に加わる。
+	class ThreadPool {
+	public:
+		explicit ThreadPool(const std::size_t numThreads = std::thread::hardware_concurrency());
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// task(0), ..., task(count - 1) を並列に実行し、全て終わるまで待つ。
+		// taskが例外を投げれば、残りの添字は実行せず、全スレッドが手を離してから最初の例外を投げ直す。
+		void ParallelFor(const std::size_t count, const std::function<void(std::size_t)>& task);
+
+		std::size_t GetNumThreads() const
+		{
+			return workers.size() + 1;
+		}
+	private:
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wakeUp;
+		std::condition_variable finished;
+		const std::function<void(std::size_t)>* currentTask = nullptr;
+		std::size_t taskCount = 0;
+		std::atomic<std::size_t> nextIndex{ 0 };
+		std::size_t generation = 0;
+		std::size_t activeWorkers = 0;
+		bool isStopping = false;
+		std::exception_ptr error;  // 実行中のParallelForで最初に投げられた例外。
+
+		void work();
+		void runTasks(const std::function<void(std::size_t)>& task, const std::size_t count);
+	};
+}
+
+#endif // !THREAD_POOL_H
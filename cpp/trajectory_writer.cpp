@@ -0,0 +1,126 @@
+﻿#include "trajectory_writer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace Simulator;
+
+namespace {
+	constexpr char Magic[8] = { 'I', 'S', 'I', 'N', 'G', 'T', 'R', 'J' };
+	constexpr std::uint32_t Version = 1;
+
+	std::size_t roundUpToPowerOfTwo(const std::size_t value)
+	{
+		std::size_t result = 1;
+		while (result < value)
+			result <<= 1;
+		return result;
+	}
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string& path, const Formats format, const std::size_t decimation, const std::size_t capacity)
+	: file(std::make_unique<std::ofstream>(path, std::ios::binary))
+	, stream(file.get())
+	, format(format)
+	, decimation(std::max<std::size_t>(decimation, 1))
+	, buffer(roundUpToPowerOfTwo(std::max<std::size_t>(capacity, 2)))
+	, mask(buffer.size() - 1)
+	, head(0)
+	, tail(0)
+	, closing(false)
+	, numWritten(0)
+	, failed(false)
+{
+	if (!*file)
+		throw std::runtime_error("TrajectoryWriter: unable to open " + path);
+	start();
+}
+
+TrajectoryWriter::TrajectoryWriter(std::ostream& stream, const Formats format, const std::size_t decimation, const std::size_t capacity)
+	: stream(&stream)
+	, format(format)
+	, decimation(std::max<std::size_t>(decimation, 1))
+	, buffer(roundUpToPowerOfTwo(std::max<std::size_t>(capacity, 2)))
+	, mask(buffer.size() - 1)
+	, head(0)
+	, tail(0)
+	, closing(false)
+	, numWritten(0)
+	, failed(false)
+{
+	start();
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	try {
+		Close();
+	} catch (...) {
+	}
+}
+
+void TrajectoryWriter::Close()
+{
+	if (!worker.joinable())
+		return;
+	closing.store(true, std::memory_order_release);
+	worker.join();
+	stream->flush();
+	if (failed || !*stream)
+		throw std::runtime_error("TrajectoryWriter: failed to write the trajectory.");
+}
+
+void TrajectoryWriter::start()
+{
+	if (format == Formats::Binary) {
+		const std::uint32_t sizes[] = { Version, static_cast<std::uint32_t>(sizeof(TrajectoryRecord)) };
+		stream->write(Magic, sizeof(Magic));
+		stream->write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+	} else {
+		*stream << "step,energy,energy_on_bipartite_graph,temperature,magnetization\n";
+	}
+	worker = std::thread([this]() { drain(); });
+}
+
+// 空ならば少し待つ。closingを先に読むので、closingが立っていれば、Closeの前に入れた記録はすべて見えている。
+void TrajectoryWriter::drain()
+{
+	std::string text;
+	auto position = head.load(std::memory_order_relaxed);
+	while (true) {
+		bool isClosing = closing.load(std::memory_order_acquire);
+		auto end = tail.load(std::memory_order_acquire);
+		if (position == end) {
+			if (isClosing)
+				break;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			continue;
+		}
+		auto first = static_cast<std::size_t>(position & mask);
+		auto count = static_cast<std::size_t>(std::min<std::uint64_t>(end - position, buffer.size() - first));  // 折り返す手前まで。
+		write(buffer.data() + first, count, text);
+		position += count;
+		head.store(position, std::memory_order_release);
+	}
+}
+
+void TrajectoryWriter::write(const TrajectoryRecord* records, const std::size_t count, std::string& text)
+{
+	if (format == Formats::Binary) {
+		stream->write(reinterpret_cast<const char*>(records), static_cast<std::streamsize>(sizeof(TrajectoryRecord) * count));
+	} else {
+		text.clear();
+		char line[160];
+		for (std::size_t k = 0; k < count; k++) {
+			const auto& record = records[k];
+			int length = std::snprintf(line, sizeof(line), "%llu,%.17g,%.17g,%.17g,%.17g\n", static_cast<unsigned long long>(record.step),
+				record.energy, record.energyOnBipartiteGraph, record.temperature, record.magnetization);
+			text.append(line, static_cast<std::size_t>(length));
+		}
+		stream->write(text.data(), static_cast<std::streamsize>(text.size()));
+	}
+	if (!*stream)
+		failed = true;
+	numWritten.fetch_add(count, std::memory_order_relaxed);
+}
@@ -0,0 +1,81 @@
+﻿#ifndef TRAJECTORY_WRITER_H
+#define TRAJECTORY_WRITER_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Simulator {
+	// 1ステップ分の記録。二値形式ではこのまま書き出す。
+	struct TrajectoryRecord {
+		std::uint64_t step;
+		double energy;
+		double energyOnBipartiteGraph;
+		double temperature;
+		double magnetization;
+	};
+
+	// 記録をリングバッファに入れ、裏のスレッドがまとめてファイルに書き出す。Pushは1つのスレッドからだけ呼ぶ。
+	// バッファが一杯のときは、Pushは書き出しが追いつくまで待つ（記録は捨てない）。
+	// CSV: 見出し行 "step,energy,energy_on_bipartite_graph,temperature,magnetization" の後に1行1記録。
+	// Binary: "ISINGTRJ", uint32 の版数と記録のバイト数の後に TrajectoryRecord を並べる。書いた環境と同じバイト順の環境で読む。
+	class TrajectoryWriter {
+	public:
+		enum class Formats {
+			Csv,
+			Binary
+		};
+
+		static constexpr std::size_t DefaultCapacity = std::size_t(1) << 16;
+
+		// decimationが1より大きければ、ステップ数がその倍数の記録だけを残す。
+		TrajectoryWriter(const std::string& path, const Formats format = Formats::Csv, const std::size_t decimation = 1, const std::size_t capacity = DefaultCapacity);
+		TrajectoryWriter(std::ostream& stream, const Formats format = Formats::Csv, const std::size_t decimation = 1, const std::size_t capacity = DefaultCapacity);
+		TrajectoryWriter(const TrajectoryWriter&) = delete;
+		TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+		~TrajectoryWriter();
+
+		// 残りを書き出してスレッドを止める。2回目以降は何もしない。書き出しに失敗していれば例外を投げる。
+		void Close();
+
+		void Push(const TrajectoryRecord& record)
+		{
+			if (decimation > 1 && record.step % decimation != 0)
+				return;
+			auto position = tail.load(std::memory_order_relaxed);
+			while (position - head.load(std::memory_order_acquire) == buffer.size())
+				std::this_thread::yield();
+			buffer[position & mask] = record;
+			tail.store(position + 1, std::memory_order_release);
+		}
+
+		std::size_t GetNumWritten() const
+		{
+			return numWritten.load(std::memory_order_relaxed);
+		}
+	private:
+		std::unique_ptr<std::ofstream> file;
+		std::ostream* stream;
+		Formats format;
+		std::size_t decimation;
+		std::vector<TrajectoryRecord> buffer;  // 大きさは2の冪。
+		std::size_t mask;
+		alignas(64) std::atomic<std::uint64_t> head;  // 次に書き出す位置。書き出すスレッドだけが進める。
+		alignas(64) std::atomic<std::uint64_t> tail;  // 次に入れる位置。Pushだけが進める。
+		std::atomic<bool> closing;
+		std::atomic<std::size_t> numWritten;
+		bool failed;
+		std::thread worker;
+
+		void start();
+		void drain();
+		void write(const TrajectoryRecord* records, const std::size_t count, std::string& text);
+	};
+}
+
+#endif // !TRAJECTORY_WRITER_H
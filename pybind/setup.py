@@ -3,6 +3,7 @@
 
 from setuptools import setup, Extension
 from setuptools.command.build_ext import build_ext
+import os
 import sys
 import setuptools
 
@@ -25,17 +26,19 @@ ext_modules = [
         'simulatorWithCpp',
         # Sort input source files to ensure bit-for-bit reproducible builds
         # (https://github.com/pybind/python_example/pull/53)
-        sorted(['pybind/wrapper.cpp', 'cpp/simulator.cpp']),
+        sorted(['pybind/wrapper.cpp', 'cpp/simulator.cpp', 'cpp/replica_batch.cpp', 'cpp/thread_pool.cpp', 'cpp/parallel_tempering.cpp', 'cpp/multi_spin_coding.cpp', 'cpp/model_file.cpp', 'cpp/async_run.cpp', 'cpp/trajectory_writer.cpp', 'cpp/portfolio.cpp']),
         include_dirs=[
             # Path to pybind11 headers
             get_pybind_include(),
             'cpp',
         ],
+        # SIMULATOR_INSTRUMENTATION=1 python setup.py build_ext ... で計装付きでビルドする。
+        define_macros=[('SIMULATOR_INSTRUMENTATION', None)] if os.environ.get('SIMULATOR_INSTRUMENTATION') else [],
         language='c++'
     ),
 ]
 
-headers = ['cpp/simulator.h']
+headers = ['cpp/simulator.h', 'cpp/replica_batch.h', 'cpp/thread_pool.h', 'cpp/parallel_tempering.h', 'cpp/multi_spin_coding.h', 'cpp/model_file.h', 'cpp/async_run.h', 'cpp/trajectory_writer.h', 'cpp/portfolio.h']
 
 # cf http://bugs.python.org/issue26689
 def has_flag(compiler, flagname):
@@ -1,14 +1,50 @@
 #include "simulator.h"
+#include "async_run.h"
+#include "model_file.h"
+#include "trajectory_writer.h"
+#include "multi_spin_coding.h"
+#include "parallel_tempering.h"
+#include "portfolio.h"
+#include "replica_batch.h"
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 #include <pybind11/iostream.h>
 #include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
+#include <fstream>
 #include <optional>
+#include <sstream>
 
 namespace py = pybind11;
 
-void Write(const Simulator::IsingModel& self)
+using IndexArray = py::array_t<std::int64_t, py::array::c_style | py::array::forcecast>;
+using WeightArray = py::array_t<double, py::array::c_style | py::array::forcecast>;
+
+// numpyの整数配列を頂点の添字の列に変換する。
+std::vector<std::size_t> toIndices(const IndexArray& array)
+{
+	auto values = array.unchecked<1>();
+	std::vector<std::size_t> indices(values.shape(0));
+	for (py::ssize_t k = 0; k < values.shape(0); k++) {
+		if (values(k) < 0)
+			throw py::value_error("Node indices must be non-negative.");
+		indices[k] = static_cast<std::size_t>(values(k));
+	}
+	return indices;
+}
+
+// dataを指す読み取り専用のnumpy配列。ownerを配列の基底にして、ownerが解放されるまでdataを有効に保つ。
+template<typename T>
+py::array_t<T> readOnlyView(const T* data, std::vector<py::ssize_t> shape, std::vector<py::ssize_t> strides, py::handle owner)
+{
+	py::array_t<T> result(std::move(shape), std::move(strides), data, owner);
+	py::detail::array_proxy(result.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+	return result;
+}
+
+template<typename Scalar>
+void Write(const Simulator::BasicIsingModel<Scalar>& self)
 {
 	py::print("Current spin configuration:");
 	py::print(self.GetSpins());
@@ -22,47 +58,236 @@ void Write(const Simulator::IsingModel& self)
 	py::print("Flip trial rate:", self.GetFlipTrialRate());
 }
 
-PYBIND11_MODULE(simulatorWithCpp, m)
+// 外部磁場と結合定数の型毎に別のクラスとして公開する。
+template<typename Scalar>
+void bindIsingModel(py::module& m, const char* name)
 {
-	m.doc() = "An Ising model simulator";
-	m.def("AlgorithmToStr", &Simulator::AlgorithmToStr);
-	py::bind_map<Simulator::LinearBiases>(m, "LinearBiases");
-	py::bind_map<Simulator::QuadraticBiases>(m, "QuadraticBiases");
-	py::class_<Simulator::IsingModel> isingModel(m, "IsingModel");
+	using Model = Simulator::BasicIsingModel<Scalar>;
+	auto fromCoo = [](const Eigen::VectorXd& linear, const IndexArray& rows, const IndexArray& columns, const WeightArray& weights,
+		const std::vector<Simulator::Node>& labels) {
+		auto values = weights.unchecked<1>();
+		return Model(linear, toIndices(rows), toIndices(columns), std::vector<double>(values.data(0), values.data(0) + values.shape(0)), labels);
+	};
+	using AsyncRun = Simulator::BasicAsyncRun<Scalar>;
+	py::class_<AsyncRun>(m, (std::string(name) + "AsyncRun").c_str())
+		.def_property_readonly("Progress", [](AsyncRun& self) {
+			auto progress = self.GetProgress();
+			py::dict result;
+			result["Step"] = progress.step;
+			result["Energy"] = progress.energy;
+			result["BestEnergy"] = progress.bestEnergy;
+			result["BestStep"] = progress.bestStep;
+			result["BestSpins"] = progress.bestSpins;
+			result["Finished"] = progress.finished;
+			return result;
+		})
+		.def_property_readonly("Finished", &AsyncRun::IsFinished)
+		.def_property_readonly("Cancelled", &AsyncRun::IsCancelled)
+		.def_property_readonly("Model", &AsyncRun::GetModel, py::return_value_policy::reference_internal)  // Waitの後で使う。
+		.def("Cancel", &AsyncRun::Cancel)
+		.def("Wait", &AsyncRun::Wait, py::call_guard<py::gil_scoped_release>());
+
+	py::class_<Model> isingModel(m, name);
 	isingModel.def(py::init<const Simulator::LinearBiases, const Simulator::QuadraticBiases>())
-		.def_property("Algorithm", &Simulator::IsingModel::GetCurrentAlgorithm, &Simulator::IsingModel::ChangeAlgorithmTo)
-		.def_property_readonly("Energy", &Simulator::IsingModel::GetEnergy)
-		.def_property_readonly("EnergyOnBipartiteGraph", &Simulator::IsingModel::GetEnergyOnBipartiteGraph)
-		.def_property("Temperature", &Simulator::IsingModel::GetTemperature, &Simulator::IsingModel::SetTemperature)
-		.def_property("PinningParameter", &Simulator::IsingModel::GetPinningParameter, &Simulator::IsingModel::SetPinningParameter)
-		.def_property("FlipTrialRate", &Simulator::IsingModel::GetFlipTrialRate, &Simulator::IsingModel::SetFlipTrialRate)
+		.def(py::init(fromCoo), py::arg("linear"), py::arg("rows"), py::arg("columns"), py::arg("weights"),
+			py::arg("labels") = std::vector<Simulator::Node>())
+		.def_static("FromCoo", fromCoo, py::arg("linear"), py::arg("rows"), py::arg("columns"), py::arg("weights"),
+			py::arg("labels") = std::vector<Simulator::Node>())
+		.def_static("Load", &Simulator::LoadModel<Scalar>, py::arg("path"))
+		.def_static("ImportGset", &Simulator::ImportGset<Scalar>, py::arg("path"))
+		.def_static("ImportQubo", [](const std::string& path) {  // (モデル, x^T Q x - H(s)) を返す。
+			double energyOffset;
+			auto model = Simulator::ImportQubo<Scalar>(path, &energyOffset);
+			return py::make_tuple(std::move(model), energyOffset);
+		}, py::arg("path"))
+		.def("Save", &Simulator::SaveModel<Scalar>, py::arg("path"))
+		.def_property("Algorithm", &Model::GetCurrentAlgorithm, &Model::ChangeAlgorithmTo)
+		.def_property_readonly("Energy", &Model::GetEnergy)
+		.def_property_readonly("EnergyOnBipartiteGraph", &Model::GetEnergyOnBipartiteGraph)
+		.def_property_readonly("Magnetization", &Model::GetMagnetization)
+		.def_property("Temperature", &Model::GetTemperature, &Model::SetTemperature)
+		.def_property("PinningParameter", &Model::GetPinningParameter, &Model::SetPinningParameter)
+		.def_property("FlipTrialRate", &Model::GetFlipTrialRate, &Model::SetFlipTrialRate)
+		.def_property("HillClimbingStrategy", &Model::GetHillClimbingStrategy, &Model::SetHillClimbingStrategy)
+		.def_property("NumThreads", &Model::GetNumThreads, &Model::SetNumThreads)
+		.def_property_readonly("NumColors", &Model::GetNumColors)
+		.def_property_readonly("Instrumentation", &Model::GetInstrumentation)
+		.def_property_readonly_static("IsInstrumented", [](const py::object&) { return Model::IsInstrumented(); })
+		.def("ResetInstrumentation", &Model::ResetInstrumentation)
+		// 以下はモデルの配列を複製せずに共有するnumpy配列。読み取り専用で、スピンの書き換えは代入で行う（差分更新のため）。
+		.def_property("SpinArray",
+			[](const py::object& self) {
+				const auto& model = self.cast<const Model&>();
+				static_assert(sizeof(Simulator::Spin) == sizeof(int));
+				auto size = static_cast<py::ssize_t>(model.GetCouplingMatrix()->Size());
+				return readOnlyView(reinterpret_cast<const int*>(model.SpinData()), { size }, { sizeof(int) }, self);
+			},
+			&Model::SetSpins)
+		.def_property_readonly("ExternalMagneticFieldArray", [](const py::object& self) {
+			const auto& model = self.cast<const Model&>();
+			auto size = static_cast<py::ssize_t>(model.GetCouplingMatrix()->Size());
+			return readOnlyView(model.ExternalMagneticFieldData(), { size }, { sizeof(*model.ExternalMagneticFieldData()) }, self);
+		})
+		.def_property_readonly("CouplingArray", [](const py::object& self) {  // 密行列の場合のみ。
+			auto couplings = self.cast<const Model&>().GetCouplingMatrix();
+			if (couplings->IsSparse())
+				throw py::value_error("The coupling coefficients are sparse; use CsrArrays.");
+			auto size = static_cast<py::ssize_t>(couplings->Size());
+			return readOnlyView(couplings->DenseData(), { size, size }, { sizeof(Scalar), size * static_cast<py::ssize_t>(sizeof(Scalar)) }, self);
+		})
+		.def_property_readonly("CsrArrays", [](const py::object& self) {  // CSR形式の場合のみ。(indptr, indices, data)
+			auto couplings = self.cast<const Model&>().GetCouplingMatrix();
+			if (!couplings->IsSparse())
+				throw py::value_error("The coupling coefficients are dense; use CouplingArray.");
+			auto size = static_cast<py::ssize_t>(couplings->Size());
+			auto numNonZeros = static_cast<py::ssize_t>(couplings->NonZeros());
+			return py::make_tuple(
+				readOnlyView(couplings->RowOffsets(), { size + 1 }, { sizeof(std::int64_t) }, self),
+				readOnlyView(couplings->ColumnIndices(), { numNonZeros }, { sizeof(std::int32_t) }, self),
+				readOnlyView(couplings->Values(), { numNonZeros }, { sizeof(Scalar) }, self));
+		})
 		.def_property("Spins",
-			[](const Simulator::IsingModel& self) -> std::map<Simulator::Node, int> {
+			[](const Model& self) -> std::map<Simulator::Node, int> {
 				std::map<Simulator::Node, int> temp;
 				for (const auto& pair : self.GetSpinsAsDictionary())
 					temp[pair.first] = static_cast<int>(pair.second);
 				return temp;
 			},
-			[](Simulator::IsingModel& self, const std::map<Simulator::Node, int> spins) {
-				std::map<Simulator::Node, Simulator::IsingModel::Spin> temp;
+			[](Model& self, const std::map<Simulator::Node, int> spins) {
+				std::map<Simulator::Node, Simulator::Spin> temp;
 				for (const auto& pair : spins)
 					if (pair.second == -1 || pair.second == +1)
-						temp[pair.first] = static_cast<Simulator::IsingModel::Spin>(pair.second);
+						temp[pair.first] = static_cast<Simulator::Spin>(pair.second);
 					else
 						throw "Error: unable to convert " + std::to_string(pair.second);
 				self.SetSpinsAsDictionary(temp);
 			}
 		)
-		.def("CalcLargestEigenvalue", &Simulator::IsingModel::CalcLargestEigenvalue)
-		.def("GiveSpins", &Simulator::IsingModel::GiveSpins)
-		.def("SetSeed", [](Simulator::IsingModel& self, const std::optional<unsigned int> seed = std::nullopt) {
+		.def("CalcLargestEigenvalue", &Model::CalcLargestEigenvalue, py::arg("tolerance") = 1.e-6, py::arg("maxIterations") = 300)
+		.def("GiveSpins", &Model::GiveSpins)
+		.def("SetSeed", [](Model& self, const std::optional<unsigned int> seed = std::nullopt, const std::uint64_t stream = 0) {
 			if (seed)
-				self.SetSeed(seed.value());
+				self.SetSeed(seed.value(), stream);
 			else
 				self.SetSeed();
-		}, py::arg("seed") = std::nullopt)
-		.def("Update", &Simulator::IsingModel::Update)
-		.def("Write", &Write);
+		}, py::arg("seed") = std::nullopt, py::arg("stream") = 0)
+		.def("Update", &Model::Update)
+		.def("Sweep", &Model::Sweep)
+		// 実行中はGILを解放するので、別々のモデルをPythonのスレッドから同時に実行できる（同じモデルを同時に使ってはならない）。
+		.def("Run", &Model::Run, py::arg("steps"), py::arg("options") = Simulator::RunOptions(), py::call_guard<py::gil_scoped_release>())
+		// 複製を裏のスレッドで実行する。元のモデルは変わらない。
+		.def("RunAsync", [](const Model& self, const std::size_t steps, const Simulator::RunOptions& options, const std::optional<double> targetEnergy) {
+			return std::make_unique<AsyncRun>(self, steps, options, targetEnergy);
+		}, py::arg("steps"), py::arg("options") = Simulator::RunOptions(), py::arg("targetEnergy") = std::nullopt)
+		.def("SaveCheckpoint", [](const Model& self, const std::string& path) {
+			std::ofstream file(path, std::ios::binary);
+			if (!file)
+				throw std::runtime_error("Unable to open " + path);
+			self.SaveCheckpoint(file);
+		}, py::arg("path"))
+		.def("LoadCheckpoint", [](Model& self, const std::string& path) {
+			std::ifstream file(path, std::ios::binary);
+			if (!file)
+				throw std::runtime_error("Unable to open " + path);
+			self.LoadCheckpoint(file);
+		}, py::arg("path"))
+		.def("Checkpoint", [](const Model& self) {  // ファイルを介さずにbytesとして受け渡す。
+			std::ostringstream stream(std::ios::binary);
+			self.SaveCheckpoint(stream);
+			return py::bytes(stream.str());
+		})
+		.def("Restore", [](Model& self, const py::bytes& checkpoint) {
+			std::istringstream stream(std::string(checkpoint), std::ios::binary);
+			self.LoadCheckpoint(stream);
+		}, py::arg("checkpoint"))
+		.def("Write", &Write<Scalar>);
+}
+
+PYBIND11_MODULE(simulatorWithCpp, m)
+{
+	m.doc() = "An Ising model simulator";
+	m.def("AlgorithmToStr", &Simulator::AlgorithmToStr);
+	py::bind_map<Simulator::LinearBiases>(m, "LinearBiases");
+	py::bind_map<Simulator::QuadraticBiases>(m, "QuadraticBiases");
+	py::enum_<Simulator::Observables>(m, "Observables")
+		.value("Energy", Simulator::Observables::Energy)
+		.value("EnergyOnBipartiteGraph", Simulator::Observables::EnergyOnBipartiteGraph)
+		.value("Temperature", Simulator::Observables::Temperature)
+		.value("Magnetization", Simulator::Observables::Magnetization)
+		.export_values();
+	py::enum_<Simulator::StepUnits>(m, "StepUnits")
+		.value("Update", Simulator::StepUnits::Update)
+		.value("Sweep", Simulator::StepUnits::Sweep)
+		.value("ColoredSweep", Simulator::StepUnits::ColoredSweep)
+		.export_values();
+	py::class_<Simulator::Schedule> schedule(m, "Schedule");
+	schedule.def(py::init<>())
+		.def_static("Constant", &Simulator::Schedule::Constant, py::arg("value"))
+		.def_static("Logarithmic", &Simulator::Schedule::Logarithmic, py::arg("initialValue"), py::arg("coefficient") = 1.e0)
+		.def_static("LinearMultiplicative", &Simulator::Schedule::LinearMultiplicative, py::arg("initialValue"), py::arg("coefficient") = 1.e0)
+		.def_static("QuadraticMultiplicative", &Simulator::Schedule::QuadraticMultiplicative, py::arg("initialValue"), py::arg("coefficient") = 1.e0)
+		.def_static("LinearAdditive", &Simulator::Schedule::LinearAdditive, py::arg("initialValue"), py::arg("finalValue"), py::arg("steps"))
+		.def_static("Exponential", &Simulator::Schedule::Exponential, py::arg("initialValue"), py::arg("rate"))
+		.def_static("Piecewise", &Simulator::Schedule::Piecewise, py::arg("points"))
+		.def_static("Tabulated", &Simulator::Schedule::Tabulated, py::arg("values"))
+		.def_property_readonly("Type", &Simulator::Schedule::GetType)
+		.def("__call__", &Simulator::Schedule::operator(), py::arg("step"));
+	py::enum_<Simulator::Schedule::Types>(schedule, "Types")
+		.value("Constant", Simulator::Schedule::Types::Constant)
+		.value("Logarithmic", Simulator::Schedule::Types::Logarithmic)
+		.value("LinearMultiplicative", Simulator::Schedule::Types::LinearMultiplicative)
+		.value("QuadraticMultiplicative", Simulator::Schedule::Types::QuadraticMultiplicative)
+		.value("LinearAdditive", Simulator::Schedule::Types::LinearAdditive)
+		.value("Exponential", Simulator::Schedule::Types::Exponential)
+		.value("Piecewise", Simulator::Schedule::Types::Piecewise)
+		.value("Tabulated", Simulator::Schedule::Types::Tabulated)
+		.export_values();
+	py::class_<Simulator::RunOptions>(m, "RunOptions")
+		.def(py::init([](const std::vector<Simulator::Observables> observables, const Simulator::StepUnits stepUnit, const std::size_t snapshotInterval) {
+			Simulator::RunOptions options{ observables, stepUnit };
+			options.snapshotInterval = snapshotInterval;
+			return options;
+		}), py::arg("observables") = std::vector<Simulator::Observables>(), py::arg("stepUnit") = Simulator::StepUnits::Update,
+			py::arg("snapshotInterval") = 0)
+		.def_readwrite("Observables", &Simulator::RunOptions::observables)
+		.def_readwrite("StepUnit", &Simulator::RunOptions::stepUnit)
+		.def_readwrite("TemperatureSchedule", &Simulator::RunOptions::temperatureSchedule)
+		.def_readwrite("PinningParameterSchedule", &Simulator::RunOptions::pinningParameterSchedule)
+		.def_readwrite("FlipTrialRateSchedule", &Simulator::RunOptions::flipTrialRateSchedule)
+		.def_readwrite("FirstStep", &Simulator::RunOptions::firstStep)
+		.def_readwrite("SnapshotInterval", &Simulator::RunOptions::snapshotInterval)
+		.def_readwrite("TrajectoryWriter", &Simulator::RunOptions::trajectoryWriter);
+	py::class_<Simulator::Instrumentation>(m, "Instrumentation")
+		.def_readonly("Proposals", &Simulator::Instrumentation::proposals)
+		.def_readonly("AcceptedFlips", &Simulator::Instrumentation::acceptedFlips)
+		.def_readonly("SynchronousSteps", &Simulator::Instrumentation::synchronousSteps)
+		.def_readonly("SynchronousFlips", &Simulator::Instrumentation::synchronousFlips)
+		.def_readonly("FieldRecalculations", &Simulator::Instrumentation::fieldRecalculations)
+		.def_readonly("FieldColumnUpdates", &Simulator::Instrumentation::fieldColumnUpdates)
+		.def_readonly("FieldSeconds", &Simulator::Instrumentation::fieldSeconds)
+		.def_readonly("RandomSeconds", &Simulator::Instrumentation::randomSeconds)
+		.def_readonly("AcceptanceSeconds", &Simulator::Instrumentation::acceptanceSeconds)
+		.def_readonly("CopySeconds", &Simulator::Instrumentation::copySeconds);
+	py::class_<Simulator::TrajectoryWriter, std::shared_ptr<Simulator::TrajectoryWriter>> trajectoryWriter(m, "TrajectoryWriter");
+	py::enum_<Simulator::TrajectoryWriter::Formats>(trajectoryWriter, "Formats")  // 既定の引数に使うので先に登録する。
+		.value("Csv", Simulator::TrajectoryWriter::Formats::Csv)
+		.value("Binary", Simulator::TrajectoryWriter::Formats::Binary)
+		.export_values();
+	trajectoryWriter.def(py::init<const std::string&, const Simulator::TrajectoryWriter::Formats, const std::size_t, const std::size_t>(),
+			py::arg("path"), py::arg("format") = Simulator::TrajectoryWriter::Formats::Csv, py::arg("decimation") = 1,
+			py::arg("capacity") = Simulator::TrajectoryWriter::DefaultCapacity)
+		.def_property_readonly("NumWritten", &Simulator::TrajectoryWriter::GetNumWritten)
+		.def("Close", &Simulator::TrajectoryWriter::Close, py::call_guard<py::gil_scoped_release>());
+	py::class_<Simulator::Trajectory>(m, "Trajectory")
+		.def_readonly("Energies", &Simulator::Trajectory::energies)
+		.def_readonly("EnergiesOnBipartiteGraph", &Simulator::Trajectory::energiesOnBipartiteGraph)
+		.def_readonly("Temperatures", &Simulator::Trajectory::temperatures)
+		.def_readonly("Magnetizations", &Simulator::Trajectory::magnetizations)
+		.def_readonly("SpinSnapshots", &Simulator::Trajectory::spinSnapshots);
+	bindIsingModel<double>(m, "IsingModel");
+	bindIsingModel<float>(m, "IsingModelFloat32");
+	bindIsingModel<std::int16_t>(m, "IsingModelInt16");
+	bindIsingModel<std::int8_t>(m, "IsingModelInt8");
 	py::enum_<Simulator::Algorithms>(m, "Algorithms")
 		.value("Metropolis", Simulator::Algorithms::Metropolis)
 		.value("Glauber", Simulator::Algorithms::Glauber)
@@ -72,9 +297,98 @@ PYBIND11_MODULE(simulatorWithCpp, m)
 		.value("MMA", Simulator::Algorithms::MMA)
 		.value("HillClimbing", Simulator::Algorithms::HillClimbing)
 		.export_values();
-	py::enum_<Simulator::IsingModel::ConfigurationsType>(m, "ConfigurationsType")
-		.value("AllDown", Simulator::IsingModel::ConfigurationsType::AllDown)
-		.value("AllUp", Simulator::IsingModel::ConfigurationsType::AllUp)
-		.value("Uniform", Simulator::IsingModel::ConfigurationsType::Uniform)
+	py::enum_<Simulator::HillClimbingStrategies>(m, "HillClimbingStrategies")
+		.value("Steepest", Simulator::HillClimbingStrategies::Steepest)
+		.value("FirstImprovement", Simulator::HillClimbingStrategies::FirstImprovement)
+		.value("Randomized", Simulator::HillClimbingStrategies::Randomized)
 		.export_values();
+	py::enum_<Simulator::ConfigurationsType>(m, "ConfigurationsType")
+		.value("AllDown", Simulator::ConfigurationsType::AllDown)
+		.value("AllUp", Simulator::ConfigurationsType::AllUp)
+		.value("Uniform", Simulator::ConfigurationsType::Uniform)
+		.export_values();
+	py::class_<Simulator::ReplicaBatch>(m, "ReplicaBatch")
+		.def(py::init<const Simulator::IsingModel&, const std::size_t>(), py::arg("isingModel"), py::arg("numReplicas"))
+		.def_property_readonly("NumReplicas", &Simulator::ReplicaBatch::GetNumReplicas)
+		.def_property("Algorithm", &Simulator::ReplicaBatch::GetCurrentAlgorithm, &Simulator::ReplicaBatch::ChangeAlgorithmTo)
+		.def_property_readonly("Energies", &Simulator::ReplicaBatch::GetEnergies)
+		.def_property_readonly("EnergiesOnBipartiteGraph", &Simulator::ReplicaBatch::GetEnergiesOnBipartiteGraph)
+		.def_property("Temperatures", &Simulator::ReplicaBatch::GetTemperatures, &Simulator::ReplicaBatch::SetTemperatures)
+		.def_property("PinningParameter", &Simulator::ReplicaBatch::GetPinningParameter, &Simulator::ReplicaBatch::SetPinningParameter)
+		.def_property("FlipTrialRate", &Simulator::ReplicaBatch::GetFlipTrialRate, &Simulator::ReplicaBatch::SetFlipTrialRate)
+		.def_property_readonly("Spins", &Simulator::ReplicaBatch::GetSpins)
+		.def("SetTemperature", &Simulator::ReplicaBatch::SetTemperature)
+		.def("GiveSpins", &Simulator::ReplicaBatch::GiveSpins)
+		.def("SetSeed", [](Simulator::ReplicaBatch& self, const std::optional<unsigned int> seed = std::nullopt) {
+			if (seed)
+				self.SetSeed(seed.value());
+			else
+				self.SetSeed();
+		}, py::arg("seed") = std::nullopt)
+		.def("Update", &Simulator::ReplicaBatch::Update);
+	py::class_<Simulator::ParallelTempering>(m, "ParallelTempering")
+		.def(py::init<const Simulator::IsingModel&, const std::vector<double>&, const std::size_t>(),
+			py::arg("isingModel"), py::arg("temperatures"), py::arg("numThreads") = std::thread::hardware_concurrency())
+		.def_property_readonly("NumReplicas", &Simulator::ParallelTempering::GetNumReplicas)
+		.def_property_readonly("Temperatures", &Simulator::ParallelTempering::GetTemperatures)
+		.def_property_readonly("Energies", &Simulator::ParallelTempering::GetEnergies)
+		.def_property_readonly("SwapRates", &Simulator::ParallelTempering::GetSwapRates)
+		.def_property_readonly("BestEnergy", &Simulator::ParallelTempering::GetBestEnergy)
+		.def_property_readonly("BestSpins", &Simulator::ParallelTempering::GetBestSpins)
+		.def("Run", &Simulator::ParallelTempering::Run, py::arg("rounds"), py::arg("stepsPerRound") = 1, py::arg("tuningInterval") = 0,
+			py::call_guard<py::gil_scoped_release>())
+		.def("TuneTemperatures", &Simulator::ParallelTempering::TuneTemperatures)
+		.def("ResetStatistics", &Simulator::ParallelTempering::ResetStatistics)
+		.def("SetSeed", &Simulator::ParallelTempering::SetSeed, py::arg("seed"));
+	py::class_<Simulator::Portfolio::Strategy>(m, "PortfolioStrategy")
+		.def(py::init([](const Simulator::Algorithms algorithm, const std::size_t steps, const Simulator::RunOptions& options,
+			const std::optional<double> pinningParameter, const std::optional<double> flipTrialRate, const std::size_t restarts) {
+			return Simulator::Portfolio::Strategy{ algorithm, steps, options, pinningParameter, flipTrialRate, restarts };
+		}), py::arg("algorithm"), py::arg("steps"), py::arg("options") = Simulator::RunOptions(), py::arg("pinningParameter") = std::nullopt,
+			py::arg("flipTrialRate") = std::nullopt, py::arg("restarts") = 1)
+		.def_readwrite("Algorithm", &Simulator::Portfolio::Strategy::algorithm)
+		.def_readwrite("Steps", &Simulator::Portfolio::Strategy::steps)
+		.def_readwrite("Options", &Simulator::Portfolio::Strategy::options)
+		.def_readwrite("PinningParameter", &Simulator::Portfolio::Strategy::pinningParameter)
+		.def_readwrite("FlipTrialRate", &Simulator::Portfolio::Strategy::flipTrialRate)
+		.def_readwrite("Restarts", &Simulator::Portfolio::Strategy::restarts);
+	py::class_<Simulator::Portfolio::Restart>(m, "PortfolioRestart")
+		.def_readonly("Strategy", &Simulator::Portfolio::Restart::strategy)
+		.def_readonly("Stream", &Simulator::Portfolio::Restart::stream)
+		.def_readonly("Energy", &Simulator::Portfolio::Restart::energy)
+		.def_readonly("BestEnergy", &Simulator::Portfolio::Restart::bestEnergy)
+		.def_readonly("Seconds", &Simulator::Portfolio::Restart::seconds);
+	py::class_<Simulator::Portfolio::Statistics>(m, "PortfolioStatistics")
+		.def_readonly("Restarts", &Simulator::Portfolio::Statistics::restarts)
+		.def_readonly("Successes", &Simulator::Portfolio::Statistics::successes)
+		.def_readonly("SuccessProbability", &Simulator::Portfolio::Statistics::successProbability)
+		.def_readonly("MeanSeconds", &Simulator::Portfolio::Statistics::meanSeconds)
+		.def_readonly("TimeToSolution", &Simulator::Portfolio::Statistics::timeToSolution);
+	py::class_<Simulator::Portfolio>(m, "Portfolio")
+		.def(py::init<const Simulator::IsingModel&, const std::size_t>(),
+			py::arg("isingModel"), py::arg("numThreads") = std::thread::hardware_concurrency())
+		.def_property_readonly("NumStrategies", &Simulator::Portfolio::GetNumStrategies)
+		.def_property_readonly("Restarts", &Simulator::Portfolio::GetRestarts)
+		.def_property_readonly("BestEnergy", &Simulator::Portfolio::GetBestEnergy)
+		.def_property_readonly("BestSpins", &Simulator::Portfolio::GetBestSpins)
+		.def_property("TargetEnergy", &Simulator::Portfolio::GetTargetEnergy, &Simulator::Portfolio::SetTargetEnergy)
+		.def("AddStrategy", &Simulator::Portfolio::AddStrategy, py::arg("strategy"))
+		.def("Run", &Simulator::Portfolio::Run, py::arg("seed"), py::call_guard<py::gil_scoped_release>())
+		.def("GetStatistics", &Simulator::Portfolio::GetStatistics, py::arg("strategy"), py::arg("targetProbability") = 0.99);
+	py::class_<Simulator::MultiSpinCodedModel>(m, "MultiSpinCodedModel")
+		.def(py::init<const Simulator::IsingModel&, const std::size_t>(), py::arg("isingModel"), py::arg("numReplicas") = 64)
+		.def_property_readonly("NumReplicas", &Simulator::MultiSpinCodedModel::GetNumReplicas)
+		.def_property("Algorithm", &Simulator::MultiSpinCodedModel::GetCurrentAlgorithm, &Simulator::MultiSpinCodedModel::ChangeAlgorithmTo)
+		.def_property("Temperature", &Simulator::MultiSpinCodedModel::GetTemperature, &Simulator::MultiSpinCodedModel::SetTemperature)
+		.def_property_readonly("Energies", &Simulator::MultiSpinCodedModel::GetEnergies)
+		.def_property_readonly("MeanEnergy", &Simulator::MultiSpinCodedModel::GetMeanEnergy)
+		.def("GetSpins", &Simulator::MultiSpinCodedModel::GetSpins, py::arg("replica"))
+		.def("GiveSpins", &Simulator::MultiSpinCodedModel::GiveSpins)
+		.def("SetSeed", [](Simulator::MultiSpinCodedModel& self, const std::optional<unsigned int> seed = std::nullopt) {
+			if (seed)
+				self.SetSeed(seed.value());
+			else
+				self.SetSeed();
+		}, py::arg("seed") = std::nullopt)
+		.def("Sweep", &Simulator::MultiSpinCodedModel::Sweep);
 }